@@ -0,0 +1,170 @@
+#pragma once
+
+#include <cstddef>
+#include <limits>
+#include <tuple>
+#include <utility>
+
+// Aggregate policies for BinarySearchTree: a monoid over the values, kept
+// for every subtree so that BinarySearchTree::aggregate answers range
+// queries in O(log n). A policy provides
+//   Type                   the aggregate,
+//   identity()             the aggregate of no values,
+//   lift(value)            the aggregate of one value,
+//   combine(left, right)   an associative merge of adjacent ranges, left
+//                          holding the smaller keys.
+// NoAggregate stores nothing and disables the queries.
+
+struct NoAggregate
+{
+    static constexpr bool enabled = false;
+
+    struct Type
+    {
+    };
+};
+
+template <typename T>
+struct SumAggregate
+{
+    static constexpr bool enabled = true;
+    using Type = T;
+
+    static Type identity();
+    static Type lift(const T& value);
+    static Type combine(const Type& left, const Type& right);
+};
+
+struct CountAggregate
+{
+    static constexpr bool enabled = true;
+    using Type = std::size_t;
+
+    static Type identity();
+    template<typename T>
+    static Type lift(const T& value);
+    static Type combine(Type left, Type right);
+};
+
+// The identities of Min and Max are the largest and the lowest T, which is
+// what an empty range yields.
+template <typename T>
+struct MinAggregate
+{
+    static constexpr bool enabled = true;
+    using Type = T;
+
+    static Type identity();
+    static Type lift(const T& value);
+    static Type combine(const Type& left, const Type& right);
+};
+
+template <typename T>
+struct MaxAggregate
+{
+    static constexpr bool enabled = true;
+    using Type = T;
+
+    static Type identity();
+    static Type lift(const T& value);
+    static Type combine(const Type& left, const Type& right);
+};
+
+// Several aggregates at once, such as count, sum, min and max for a rollup;
+// Type is the tuple of the parts' types.
+template <typename... Parts>
+struct TupleAggregate
+{
+    static constexpr bool enabled = true;
+    using Type = std::tuple<typename Parts::Type...>;
+
+    static Type identity();
+    template<typename T>
+    static Type lift(const T& value);
+    static Type combine(const Type& left, const Type& right);
+
+private:
+    template<std::size_t... Indices>
+    static Type combine(const Type& left, const Type& right, std::index_sequence<Indices...>);
+};
+
+template<typename T>
+typename SumAggregate<T>::Type SumAggregate<T>::identity() {
+    return T();
+}
+
+template<typename T>
+typename SumAggregate<T>::Type SumAggregate<T>::lift(const T& value) {
+    return value;
+}
+
+template<typename T>
+typename SumAggregate<T>::Type SumAggregate<T>::combine(const Type& left, const Type& right) {
+    return left + right;
+}
+
+inline CountAggregate::Type CountAggregate::identity() {
+    return 0;
+}
+
+template<typename T>
+CountAggregate::Type CountAggregate::lift(const T&) {
+    return 1;
+}
+
+inline CountAggregate::Type CountAggregate::combine(Type left, Type right) {
+    return left + right;
+}
+
+template<typename T>
+typename MinAggregate<T>::Type MinAggregate<T>::identity() {
+    return std::numeric_limits<T>::max();
+}
+
+template<typename T>
+typename MinAggregate<T>::Type MinAggregate<T>::lift(const T& value) {
+    return value;
+}
+
+template<typename T>
+typename MinAggregate<T>::Type MinAggregate<T>::combine(const Type& left, const Type& right) {
+    return right < left ? right : left;
+}
+
+template<typename T>
+typename MaxAggregate<T>::Type MaxAggregate<T>::identity() {
+    return std::numeric_limits<T>::lowest();
+}
+
+template<typename T>
+typename MaxAggregate<T>::Type MaxAggregate<T>::lift(const T& value) {
+    return value;
+}
+
+template<typename T>
+typename MaxAggregate<T>::Type MaxAggregate<T>::combine(const Type& left, const Type& right) {
+    return left < right ? right : left;
+}
+
+template<typename... Parts>
+typename TupleAggregate<Parts...>::Type TupleAggregate<Parts...>::identity() {
+    return Type(Parts::identity()...);
+}
+
+template<typename... Parts>
+template<typename T>
+typename TupleAggregate<Parts...>::Type TupleAggregate<Parts...>::lift(const T& value) {
+    return Type(Parts::lift(value)...);
+}
+
+template<typename... Parts>
+typename TupleAggregate<Parts...>::Type TupleAggregate<Parts...>::combine(const Type& left, const Type& right) {
+    return combine(left, right, std::index_sequence_for<Parts...>());
+}
+
+template<typename... Parts>
+template<std::size_t... Indices>
+typename TupleAggregate<Parts...>::Type TupleAggregate<Parts...>::combine(const Type& left, const Type& right,
+                                                                           std::index_sequence<Indices...>) {
+    return Type(Parts::combine(std::get<Indices>(left), std::get<Indices>(right))...);
+}
@@ -0,0 +1,912 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <queue>
+#include <tuple>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "KeySearch.h"
+#include "Parallel.h"
+
+// B+ tree multimap with the same lookup, insert, erase and iteration
+// interface as BinarySearchTree. Keys and values live in separate contiguous
+// arrays inside wide leaves, and leaves are linked for O(1) iteration steps.
+// Positions inside a node are found with KeySearch, which is vectorised for
+// arithmetic keys.
+// Key and Value must be default constructible and move assignable.
+template <typename Key, typename Value, std::size_t Capacity = 32>
+class BTree
+{
+    static_assert(Capacity >= 4, "BTree nodes must hold at least four keys");
+
+    struct InternalNode;
+
+public:
+    class ConstIterator;
+    // KeySearch orders keys with operator<.
+    using KeyCompare = std::less<Key>;
+
+private:
+    struct Node
+    {
+        explicit Node(bool isLeaf);
+
+        bool isLeaf;
+        std::size_t count = 0;
+        InternalNode* parent = nullptr;
+    };
+
+    struct LeafNode : Node
+    {
+        LeafNode();
+
+        Key keys[Capacity];
+        Value values[Capacity];
+        LeafNode* prev = nullptr;
+        LeafNode* next = nullptr;
+    };
+
+    struct InternalNode : Node
+    {
+        InternalNode();
+
+        Key keys[Capacity];
+        Node* children[Capacity + 1];
+    };
+
+    template <typename Reference>
+    struct ArrowProxy
+    {
+        Reference reference;
+        Reference* operator->();
+    };
+
+    static constexpr std::size_t minLeafCount = Capacity / 2;
+    static constexpr std::size_t minInternalCount = Capacity / 2 - 1;
+
+    static std::size_t minCount(const Node* node);
+    static std::size_t indexInParent(const Node* node);
+
+    LeafNode* findLeaf(const Key& key, bool upper) const;
+    std::pair<LeafNode*, std::size_t> lowerBoundPosition(const Key& key) const;
+    std::pair<LeafNode*, std::size_t> upperBoundPosition(const Key& key) const;
+
+    void splitChild(InternalNode* parent, std::size_t index);
+    void borrowFromLeft(InternalNode* parent, std::size_t index);
+    void borrowFromRight(InternalNode* parent, std::size_t index);
+    void merge(InternalNode* parent, std::size_t index);
+    void fixUnderflow(Node* node);
+    void clear();
+
+public:
+    BTree() = default;
+
+    template<typename InputIterator>
+    BTree(InputIterator first, InputIterator last);
+
+    BTree(const BTree& other) = delete;
+    BTree& operator=(const BTree& other) = delete;
+
+    BTree(BTree&& other) noexcept;
+    BTree& operator=(BTree&& other) noexcept;
+
+    ~BTree();
+
+    class Iterator
+    {
+    public:
+        Iterator(LeafNode* leaf = nullptr, std::size_t index = 0);
+
+        std::pair<const Key&, Value&> operator*() const;
+        ArrowProxy<std::pair<const Key&, Value&>> operator->() const;
+
+        Iterator operator++();
+        Iterator operator++(int);
+
+        Iterator operator--();
+        Iterator operator--(int);
+
+        bool operator==(const Iterator& other) const;
+        bool operator!=(const Iterator& other) const;
+
+    private:
+        friend class BTree;
+        friend class ConstIterator;
+
+        LeafNode* _leaf;
+        std::size_t _index;
+    };
+
+    class ConstIterator
+    {
+    public:
+        ConstIterator(const LeafNode* leaf = nullptr, std::size_t index = 0);
+        ConstIterator(const Iterator& other);
+
+        std::pair<const Key&, const Value&> operator*() const;
+        ArrowProxy<std::pair<const Key&, const Value&>> operator->() const;
+
+        ConstIterator operator++();
+        ConstIterator operator++(int);
+
+        ConstIterator operator--();
+        ConstIterator operator--(int);
+
+        bool operator==(const ConstIterator& other) const;
+        bool operator!=(const ConstIterator& other) const;
+
+    private:
+        const LeafNode* _leaf;
+        std::size_t _index;
+    };
+
+    // Replaces the contents with [first, last), packing sorted input into
+    // evenly filled leaves in O(n).
+    template<typename InputIterator>
+    void assign(InputIterator first, InputIterator last);
+
+    Iterator insert(const Key& key, const Value& value);
+    Iterator insert(Key&& key, Value&& value);
+
+    template<typename... Args>
+    Iterator emplace(Args&&... args);
+
+    template<typename... Args>
+    std::pair<Iterator, bool> tryEmplace(const Key& key, Args&&... args);
+
+    std::size_t erase(const Key& key);
+
+    ConstIterator find(const Key& key) const;
+    Iterator find(const Key& key);
+
+    Iterator lowerBound(const Key& key);
+    ConstIterator lowerBound(const Key& key) const;
+
+    Iterator upperBound(const Key& key);
+    ConstIterator upperBound(const Key& key) const;
+
+    std::pair<Iterator, Iterator> equalRange(const Key& key);
+    std::pair<ConstIterator, ConstIterator> equalRange(const Key& key) const;
+
+    Iterator begin();
+    Iterator end();
+
+    ConstIterator cbegin() const;
+    ConstIterator cend() const;
+
+    std::size_t size() const;
+    std::size_t height() const;
+    KeyCompare keyCompare() const;
+
+private:
+    template<typename K, typename V>
+    Iterator insertEntry(K&& key, V&& value);
+
+    template<typename RandomIterator>
+    void build(RandomIterator first, std::size_t count);
+
+    std::size_t _size = 0;
+    Node* _root = nullptr;
+    LeafNode* _first = nullptr;
+};
+
+template<typename Key, typename Value, std::size_t Capacity>
+BTree<Key, Value, Capacity>::Node::Node(bool isLeaf): isLeaf(isLeaf) {
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+BTree<Key, Value, Capacity>::LeafNode::LeafNode(): Node(true) {
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+BTree<Key, Value, Capacity>::InternalNode::InternalNode(): Node(false) {
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+template<typename Reference>
+Reference* BTree<Key, Value, Capacity>::ArrowProxy<Reference>::operator->() {
+    return &reference;
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+BTree<Key, Value, Capacity>::Iterator::Iterator(BTree::LeafNode* leaf, std::size_t index): _leaf(leaf), _index(index) {
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+std::pair<const Key&, Value&> BTree<Key, Value, Capacity>::Iterator::operator*() const {
+    return {_leaf->keys[_index], _leaf->values[_index]};
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+typename BTree<Key, Value, Capacity>::template ArrowProxy<std::pair<const Key&, Value&>>
+        BTree<Key, Value, Capacity>::Iterator::operator->() const {
+    return {**this};
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+typename BTree<Key, Value, Capacity>::Iterator BTree<Key, Value, Capacity>::Iterator::operator++() {
+    if (_leaf == nullptr) {
+        return *this;
+    }
+    if (++_index == _leaf->count) {
+        _leaf = _leaf->next;
+        _index = 0;
+    }
+    return *this;
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+typename BTree<Key, Value, Capacity>::Iterator BTree<Key, Value, Capacity>::Iterator::operator++(int) {
+    Iterator previous = *this;
+    ++(*this);
+    return previous;
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+typename BTree<Key, Value, Capacity>::Iterator BTree<Key, Value, Capacity>::Iterator::operator--() {
+    if (_leaf == nullptr) {
+        return *this;
+    }
+    if (_index > 0) {
+        _index--;
+    }
+    else {
+        _leaf = _leaf->prev;
+        _index = _leaf != nullptr ? _leaf->count - 1 : 0;
+    }
+    return *this;
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+typename BTree<Key, Value, Capacity>::Iterator BTree<Key, Value, Capacity>::Iterator::operator--(int) {
+    Iterator previous = *this;
+    --(*this);
+    return previous;
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+bool BTree<Key, Value, Capacity>::Iterator::operator==(const BTree::Iterator& other) const {
+    return _leaf == other._leaf && _index == other._index;
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+bool BTree<Key, Value, Capacity>::Iterator::operator!=(const BTree::Iterator& other) const {
+    return !(*this == other);
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+BTree<Key, Value, Capacity>::ConstIterator::ConstIterator(const BTree::LeafNode* leaf, std::size_t index):
+        _leaf(leaf), _index(index) {
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+BTree<Key, Value, Capacity>::ConstIterator::ConstIterator(const BTree::Iterator& other):
+        _leaf(other._leaf), _index(other._index) {
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+std::pair<const Key&, const Value&> BTree<Key, Value, Capacity>::ConstIterator::operator*() const {
+    return {_leaf->keys[_index], _leaf->values[_index]};
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+typename BTree<Key, Value, Capacity>::template ArrowProxy<std::pair<const Key&, const Value&>>
+        BTree<Key, Value, Capacity>::ConstIterator::operator->() const {
+    return {**this};
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+typename BTree<Key, Value, Capacity>::ConstIterator BTree<Key, Value, Capacity>::ConstIterator::operator++() {
+    if (_leaf == nullptr) {
+        return *this;
+    }
+    if (++_index == _leaf->count) {
+        _leaf = _leaf->next;
+        _index = 0;
+    }
+    return *this;
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+typename BTree<Key, Value, Capacity>::ConstIterator BTree<Key, Value, Capacity>::ConstIterator::operator++(int) {
+    ConstIterator previous = *this;
+    ++(*this);
+    return previous;
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+typename BTree<Key, Value, Capacity>::ConstIterator BTree<Key, Value, Capacity>::ConstIterator::operator--() {
+    if (_leaf == nullptr) {
+        return *this;
+    }
+    if (_index > 0) {
+        _index--;
+    }
+    else {
+        _leaf = _leaf->prev;
+        _index = _leaf != nullptr ? _leaf->count - 1 : 0;
+    }
+    return *this;
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+typename BTree<Key, Value, Capacity>::ConstIterator BTree<Key, Value, Capacity>::ConstIterator::operator--(int) {
+    ConstIterator previous = *this;
+    --(*this);
+    return previous;
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+bool BTree<Key, Value, Capacity>::ConstIterator::operator==(const BTree::ConstIterator& other) const {
+    return _leaf == other._leaf && _index == other._index;
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+bool BTree<Key, Value, Capacity>::ConstIterator::operator!=(const BTree::ConstIterator& other) const {
+    return !(*this == other);
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+template<typename InputIterator>
+BTree<Key, Value, Capacity>::BTree(InputIterator first, InputIterator last) {
+    assign(first, last);
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+BTree<Key, Value, Capacity>::BTree(BTree&& other) noexcept {
+    *this = std::move(other);
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+BTree<Key, Value, Capacity>& BTree<Key, Value, Capacity>::operator=(BTree&& other) noexcept {
+    if (this != &other) {
+        clear();
+        std::swap(_root, other._root);
+        std::swap(_first, other._first);
+        std::swap(_size, other._size);
+    }
+    return *this;
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+BTree<Key, Value, Capacity>::~BTree() {
+    clear();
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+std::size_t BTree<Key, Value, Capacity>::minCount(const BTree::Node* node) {
+    return node->isLeaf ? minLeafCount : minInternalCount;
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+std::size_t BTree<Key, Value, Capacity>::indexInParent(const BTree::Node* node) {
+    const InternalNode* parent = node->parent;
+    std::size_t index = 0;
+    while (parent->children[index] != node) {
+        index++;
+    }
+    return index;
+}
+
+// Leaf reached by descending towards the first element not less than key
+// (or, when upper is set, the first element greater than key).
+template<typename Key, typename Value, std::size_t Capacity>
+typename BTree<Key, Value, Capacity>::LeafNode* BTree<Key, Value, Capacity>::findLeaf(const Key& key, bool upper) const {
+    Node* node = _root;
+    if (node == nullptr) {
+        return nullptr;
+    }
+    while (!node->isLeaf) {
+        auto internal = static_cast<InternalNode*>(node);
+        std::size_t index = upper ? KeySearch<Key>::upperBound(internal->keys, internal->count, key)
+                                  : KeySearch<Key>::lowerBound(internal->keys, internal->count, key);
+        node = internal->children[index];
+    }
+    return static_cast<LeafNode*>(node);
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+std::pair<typename BTree<Key, Value, Capacity>::LeafNode*, std::size_t>
+        BTree<Key, Value, Capacity>::lowerBoundPosition(const Key& key) const {
+    LeafNode* leaf = findLeaf(key, false);
+    if (leaf == nullptr) {
+        return std::make_pair(nullptr, 0);
+    }
+    std::size_t index = KeySearch<Key>::lowerBound(leaf->keys, leaf->count, key);
+    if (index == leaf->count) {
+        return std::make_pair(leaf->next, 0);
+    }
+    return std::make_pair(leaf, index);
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+std::pair<typename BTree<Key, Value, Capacity>::LeafNode*, std::size_t>
+        BTree<Key, Value, Capacity>::upperBoundPosition(const Key& key) const {
+    LeafNode* leaf = findLeaf(key, true);
+    if (leaf == nullptr) {
+        return std::make_pair(nullptr, 0);
+    }
+    std::size_t index = KeySearch<Key>::upperBound(leaf->keys, leaf->count, key);
+    if (index == leaf->count) {
+        return std::make_pair(leaf->next, 0);
+    }
+    return std::make_pair(leaf, index);
+}
+
+// Splits the full child at index in two and adds the separator to parent,
+// which must not be full.
+template<typename Key, typename Value, std::size_t Capacity>
+void BTree<Key, Value, Capacity>::splitChild(BTree::InternalNode* parent, std::size_t index) {
+    Node* child = parent->children[index];
+    Node* sibling;
+    Key separator;
+    if (child->isLeaf) {
+        auto leaf = static_cast<LeafNode*>(child);
+        auto newLeaf = new LeafNode();
+        std::size_t middle = Capacity / 2;
+        std::move(leaf->keys + middle, leaf->keys + Capacity, newLeaf->keys);
+        std::move(leaf->values + middle, leaf->values + Capacity, newLeaf->values);
+        newLeaf->count = Capacity - middle;
+        leaf->count = middle;
+        newLeaf->next = leaf->next;
+        if (leaf->next != nullptr) {
+            leaf->next->prev = newLeaf;
+        }
+        leaf->next = newLeaf;
+        newLeaf->prev = leaf;
+        separator = newLeaf->keys[0];
+        sibling = newLeaf;
+    }
+    else {
+        auto internal = static_cast<InternalNode*>(child);
+        auto newInternal = new InternalNode();
+        std::size_t middle = Capacity / 2;
+        separator = std::move(internal->keys[middle]);
+        std::move(internal->keys + middle + 1, internal->keys + Capacity, newInternal->keys);
+        std::copy(internal->children + middle + 1, internal->children + Capacity + 1, newInternal->children);
+        newInternal->count = Capacity - middle - 1;
+        internal->count = middle;
+        for (std::size_t i = 0; i <= newInternal->count; i++) {
+            newInternal->children[i]->parent = newInternal;
+        }
+        sibling = newInternal;
+    }
+    std::move_backward(parent->keys + index, parent->keys + parent->count, parent->keys + parent->count + 1);
+    std::copy_backward(parent->children + index + 1, parent->children + parent->count + 1,
+                       parent->children + parent->count + 2);
+    parent->keys[index] = std::move(separator);
+    parent->children[index + 1] = sibling;
+    sibling->parent = parent;
+    parent->count++;
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+void BTree<Key, Value, Capacity>::borrowFromLeft(BTree::InternalNode* parent, std::size_t index) {
+    Node* child = parent->children[index];
+    Node* left = parent->children[index - 1];
+    if (child->isLeaf) {
+        auto leaf = static_cast<LeafNode*>(child);
+        auto leftLeaf = static_cast<LeafNode*>(left);
+        std::move_backward(leaf->keys, leaf->keys + leaf->count, leaf->keys + leaf->count + 1);
+        std::move_backward(leaf->values, leaf->values + leaf->count, leaf->values + leaf->count + 1);
+        leaf->keys[0] = std::move(leftLeaf->keys[leftLeaf->count - 1]);
+        leaf->values[0] = std::move(leftLeaf->values[leftLeaf->count - 1]);
+        parent->keys[index - 1] = leaf->keys[0];
+    }
+    else {
+        auto internal = static_cast<InternalNode*>(child);
+        auto leftInternal = static_cast<InternalNode*>(left);
+        std::move_backward(internal->keys, internal->keys + internal->count, internal->keys + internal->count + 1);
+        std::copy_backward(internal->children, internal->children + internal->count + 1,
+                           internal->children + internal->count + 2);
+        internal->keys[0] = std::move(parent->keys[index - 1]);
+        internal->children[0] = leftInternal->children[leftInternal->count];
+        internal->children[0]->parent = internal;
+        parent->keys[index - 1] = std::move(leftInternal->keys[leftInternal->count - 1]);
+    }
+    left->count--;
+    child->count++;
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+void BTree<Key, Value, Capacity>::borrowFromRight(BTree::InternalNode* parent, std::size_t index) {
+    Node* child = parent->children[index];
+    Node* right = parent->children[index + 1];
+    if (child->isLeaf) {
+        auto leaf = static_cast<LeafNode*>(child);
+        auto rightLeaf = static_cast<LeafNode*>(right);
+        leaf->keys[leaf->count] = std::move(rightLeaf->keys[0]);
+        leaf->values[leaf->count] = std::move(rightLeaf->values[0]);
+        std::move(rightLeaf->keys + 1, rightLeaf->keys + rightLeaf->count, rightLeaf->keys);
+        std::move(rightLeaf->values + 1, rightLeaf->values + rightLeaf->count, rightLeaf->values);
+        parent->keys[index] = rightLeaf->keys[0];
+    }
+    else {
+        auto internal = static_cast<InternalNode*>(child);
+        auto rightInternal = static_cast<InternalNode*>(right);
+        internal->keys[internal->count] = std::move(parent->keys[index]);
+        internal->children[internal->count + 1] = rightInternal->children[0];
+        internal->children[internal->count + 1]->parent = internal;
+        parent->keys[index] = std::move(rightInternal->keys[0]);
+        std::move(rightInternal->keys + 1, rightInternal->keys + rightInternal->count, rightInternal->keys);
+        std::copy(rightInternal->children + 1, rightInternal->children + rightInternal->count + 1,
+                  rightInternal->children);
+    }
+    right->count--;
+    child->count++;
+}
+
+// Merges the child at index + 1 into the child at index and drops their
+// separator from parent.
+template<typename Key, typename Value, std::size_t Capacity>
+void BTree<Key, Value, Capacity>::merge(BTree::InternalNode* parent, std::size_t index) {
+    Node* left = parent->children[index];
+    Node* right = parent->children[index + 1];
+    if (left->isLeaf) {
+        auto leftLeaf = static_cast<LeafNode*>(left);
+        auto rightLeaf = static_cast<LeafNode*>(right);
+        std::move(rightLeaf->keys, rightLeaf->keys + rightLeaf->count, leftLeaf->keys + leftLeaf->count);
+        std::move(rightLeaf->values, rightLeaf->values + rightLeaf->count, leftLeaf->values + leftLeaf->count);
+        leftLeaf->count += rightLeaf->count;
+        leftLeaf->next = rightLeaf->next;
+        if (rightLeaf->next != nullptr) {
+            rightLeaf->next->prev = leftLeaf;
+        }
+        delete rightLeaf;
+    }
+    else {
+        auto leftInternal = static_cast<InternalNode*>(left);
+        auto rightInternal = static_cast<InternalNode*>(right);
+        leftInternal->keys[leftInternal->count] = std::move(parent->keys[index]);
+        std::move(rightInternal->keys, rightInternal->keys + rightInternal->count,
+                  leftInternal->keys + leftInternal->count + 1);
+        std::copy(rightInternal->children, rightInternal->children + rightInternal->count + 1,
+                  leftInternal->children + leftInternal->count + 1);
+        for (std::size_t i = 0; i <= rightInternal->count; i++) {
+            rightInternal->children[i]->parent = leftInternal;
+        }
+        leftInternal->count += rightInternal->count + 1;
+        delete rightInternal;
+    }
+    std::move(parent->keys + index + 1, parent->keys + parent->count, parent->keys + index);
+    std::copy(parent->children + index + 2, parent->children + parent->count + 1, parent->children + index + 1);
+    parent->count--;
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+void BTree<Key, Value, Capacity>::fixUnderflow(BTree::Node* node) {
+    while (node != _root && node->count < minCount(node)) {
+        InternalNode* parent = node->parent;
+        std::size_t index = indexInParent(node);
+        if (index > 0 && parent->children[index - 1]->count > minCount(node)) {
+            borrowFromLeft(parent, index);
+        }
+        else if (index < parent->count && parent->children[index + 1]->count > minCount(node)) {
+            borrowFromRight(parent, index);
+        }
+        else {
+            merge(parent, index > 0 ? index - 1 : index);
+            node = parent;
+        }
+    }
+    if (!_root->isLeaf && _root->count == 0) {
+        Node* oldRoot = _root;
+        _root = static_cast<InternalNode*>(oldRoot)->children[0];
+        _root->parent = nullptr;
+        delete static_cast<InternalNode*>(oldRoot);
+    }
+    else if (_root->isLeaf && _root->count == 0) {
+        delete static_cast<LeafNode*>(_root);
+        _root = nullptr;
+        _first = nullptr;
+    }
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+void BTree<Key, Value, Capacity>::clear() {
+    if (_root != nullptr) {
+        std::queue<Node*> children;
+        children.push(_root);
+        while (!children.empty()) {
+            Node* curNode = children.front();
+            if (curNode->isLeaf) {
+                delete static_cast<LeafNode*>(curNode);
+            }
+            else {
+                auto internal = static_cast<InternalNode*>(curNode);
+                for (std::size_t i = 0; i <= internal->count; i++) {
+                    children.push(internal->children[i]);
+                }
+                delete internal;
+            }
+            children.pop();
+        }
+    }
+    _root = nullptr;
+    _first = nullptr;
+    _size = 0;
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+template<typename InputIterator>
+void BTree<Key, Value, Capacity>::assign(InputIterator first, InputIterator last) {
+    clear();
+    auto keyLess = [](const auto& left, const auto& right) {
+        return left.first < right.first;
+    };
+    using Category = typename std::iterator_traits<InputIterator>::iterator_category;
+    if constexpr (std::is_base_of_v<std::random_access_iterator_tag, Category>) {
+        if (std::is_sorted(first, last, keyLess)) {
+            build(first, last - first);
+            return;
+        }
+    }
+    std::vector<std::pair<Key, Value>> entries(first, last);
+    if (!std::is_sorted(entries.begin(), entries.end(), keyLess)) {
+        parallelStableSort(entries.begin(), entries.end(), keyLess);
+    }
+    build(std::make_move_iterator(entries.begin()), entries.size());
+}
+
+// Spreads the entries evenly over the fewest leaves that can hold them, then
+// builds each internal level the same way, so every node meets its minimum
+// fill without any splitting.
+template<typename Key, typename Value, std::size_t Capacity>
+template<typename RandomIterator>
+void BTree<Key, Value, Capacity>::build(RandomIterator first, std::size_t count) {
+    if (count == 0) {
+        return;
+    }
+    std::vector<Node*> level;
+    std::vector<Node*> parents;
+    std::vector<Key> minKeys;
+    try {
+        std::size_t leafCount = (count + Capacity - 1) / Capacity;
+        LeafNode* previous = nullptr;
+        for (std::size_t i = 0; i < leafCount; i++) {
+            auto leaf = new LeafNode();
+            level.push_back(leaf);
+            leaf->prev = previous;
+            if (previous != nullptr) {
+                previous->next = leaf;
+            }
+            previous = leaf;
+            for (std::size_t position = count * i / leafCount; position < count * (i + 1) / leafCount; position++) {
+                auto&& entry = first[position];
+                leaf->keys[leaf->count] = std::forward<decltype(entry)>(entry).first;
+                leaf->values[leaf->count] = std::forward<decltype(entry)>(entry).second;
+                leaf->count++;
+            }
+            minKeys.push_back(leaf->keys[0]);
+        }
+        while (level.size() > 1) {
+            std::size_t childCount = level.size();
+            std::size_t parentCount = (childCount + Capacity) / (Capacity + 1);
+            std::vector<Key> parentMinKeys;
+            for (std::size_t i = 0; i < parentCount; i++) {
+                auto internal = new InternalNode();
+                parents.push_back(internal);
+                std::size_t from = childCount * i / parentCount;
+                std::size_t to = childCount * (i + 1) / parentCount;
+                for (std::size_t child = from; child < to; child++) {
+                    internal->children[child - from] = level[child];
+                    level[child]->parent = internal;
+                    if (child > from) {
+                        internal->keys[child - from - 1] = std::move(minKeys[child]);
+                    }
+                }
+                internal->count = to - from - 1;
+                parentMinKeys.push_back(std::move(minKeys[from]));
+            }
+            level.swap(parents);
+            parents.clear();
+            minKeys = std::move(parentMinKeys);
+        }
+    }
+    catch (...) {
+        for (Node* node : parents) {
+            delete static_cast<InternalNode*>(node);
+        }
+        for (Node* node : level) {
+            _root = node;
+            clear();
+        }
+        throw;
+    }
+    _root = level.front();
+    while (!level.front()->isLeaf) {
+        level.front() = static_cast<InternalNode*>(level.front())->children[0];
+    }
+    _first = static_cast<LeafNode*>(level.front());
+    _size = count;
+}
+
+// Splits full nodes on the way down, so the leaf always has room and no
+// split ever has to propagate back up. Descends towards the first equal key
+// so a duplicate lands before the ones already stored, as in BinarySearchTree.
+template<typename Key, typename Value, std::size_t Capacity>
+template<typename K, typename V>
+typename BTree<Key, Value, Capacity>::Iterator BTree<Key, Value, Capacity>::insertEntry(K&& key, V&& value) {
+    if (_root == nullptr) {
+        _first = new LeafNode();
+        _root = _first;
+    }
+    if (_root->count == Capacity) {
+        auto newRoot = new InternalNode();
+        newRoot->children[0] = _root;
+        _root->parent = newRoot;
+        _root = newRoot;
+        splitChild(newRoot, 0);
+    }
+    Node* node = _root;
+    while (!node->isLeaf) {
+        auto internal = static_cast<InternalNode*>(node);
+        std::size_t index = KeySearch<Key>::lowerBound(internal->keys, internal->count, key);
+        if (internal->children[index]->count == Capacity) {
+            splitChild(internal, index);
+            if (internal->keys[index] < key) {
+                index++;
+            }
+        }
+        node = internal->children[index];
+    }
+    auto leaf = static_cast<LeafNode*>(node);
+    std::size_t index = KeySearch<Key>::lowerBound(leaf->keys, leaf->count, key);
+    std::move_backward(leaf->keys + index, leaf->keys + leaf->count, leaf->keys + leaf->count + 1);
+    std::move_backward(leaf->values + index, leaf->values + leaf->count, leaf->values + leaf->count + 1);
+    leaf->keys[index] = std::forward<K>(key);
+    leaf->values[index] = std::forward<V>(value);
+    leaf->count++;
+    _size++;
+    return Iterator(leaf, index);
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+typename BTree<Key, Value, Capacity>::Iterator BTree<Key, Value, Capacity>::insert(const Key& key, const Value& value) {
+    return insertEntry(key, value);
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+typename BTree<Key, Value, Capacity>::Iterator BTree<Key, Value, Capacity>::insert(Key&& key, Value&& value) {
+    return insertEntry(std::move(key), std::move(value));
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+template<typename... Args>
+typename BTree<Key, Value, Capacity>::Iterator BTree<Key, Value, Capacity>::emplace(Args&&... args) {
+    std::pair<Key, Value> keyValuePair(std::forward<Args>(args)...);
+    return insertEntry(std::move(keyValuePair.first), std::move(keyValuePair.second));
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+template<typename... Args>
+std::pair<typename BTree<Key, Value, Capacity>::Iterator, bool>
+        BTree<Key, Value, Capacity>::tryEmplace(const Key& key, Args&&... args) {
+    Iterator bound = lowerBound(key);
+    if (bound != end() && bound->first == key) {
+        return std::make_pair(bound, false);
+    }
+    return std::make_pair(insertEntry(key, Value(std::forward<Args>(args)...)), true);
+}
+
+// Removes the run of duplicates one leaf at a time.
+template<typename Key, typename Value, std::size_t Capacity>
+std::size_t BTree<Key, Value, Capacity>::erase(const Key& key) {
+    std::size_t erased = 0;
+    while (true) {
+        auto [leaf, index] = lowerBoundPosition(key);
+        if (leaf == nullptr || !(leaf->keys[index] == key)) {
+            break;
+        }
+        std::size_t last = index;
+        while (last < leaf->count && leaf->keys[last] == key) {
+            last++;
+        }
+        std::move(leaf->keys + last, leaf->keys + leaf->count, leaf->keys + index);
+        std::move(leaf->values + last, leaf->values + leaf->count, leaf->values + index);
+        leaf->count -= last - index;
+        _size -= last - index;
+        erased += last - index;
+        fixUnderflow(leaf);
+    }
+    return erased;
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+typename BTree<Key, Value, Capacity>::ConstIterator BTree<Key, Value, Capacity>::find(const Key& key) const {
+    ConstIterator bound = lowerBound(key);
+    if (bound == cend() || !(bound->first == key)) {
+        return cend();
+    }
+    return bound;
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+typename BTree<Key, Value, Capacity>::Iterator BTree<Key, Value, Capacity>::find(const Key& key) {
+    Iterator bound = lowerBound(key);
+    if (bound == end() || !(bound->first == key)) {
+        return end();
+    }
+    return bound;
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+typename BTree<Key, Value, Capacity>::Iterator BTree<Key, Value, Capacity>::lowerBound(const Key& key) {
+    auto [leaf, index] = lowerBoundPosition(key);
+    return Iterator(leaf, index);
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+typename BTree<Key, Value, Capacity>::ConstIterator BTree<Key, Value, Capacity>::lowerBound(const Key& key) const {
+    auto [leaf, index] = lowerBoundPosition(key);
+    return ConstIterator(leaf, index);
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+typename BTree<Key, Value, Capacity>::Iterator BTree<Key, Value, Capacity>::upperBound(const Key& key) {
+    auto [leaf, index] = upperBoundPosition(key);
+    return Iterator(leaf, index);
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+typename BTree<Key, Value, Capacity>::ConstIterator BTree<Key, Value, Capacity>::upperBound(const Key& key) const {
+    auto [leaf, index] = upperBoundPosition(key);
+    return ConstIterator(leaf, index);
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+std::pair<typename BTree<Key, Value, Capacity>::Iterator, typename BTree<Key, Value, Capacity>::Iterator>
+        BTree<Key, Value, Capacity>::equalRange(const Key& key) {
+    return std::make_pair(lowerBound(key), upperBound(key));
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+std::pair<typename BTree<Key, Value, Capacity>::ConstIterator, typename BTree<Key, Value, Capacity>::ConstIterator>
+        BTree<Key, Value, Capacity>::equalRange(const Key& key) const {
+    return std::make_pair(lowerBound(key), upperBound(key));
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+typename BTree<Key, Value, Capacity>::Iterator BTree<Key, Value, Capacity>::begin() {
+    return Iterator(_first, 0);
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+typename BTree<Key, Value, Capacity>::Iterator BTree<Key, Value, Capacity>::end() {
+    return Iterator(nullptr, 0);
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+typename BTree<Key, Value, Capacity>::ConstIterator BTree<Key, Value, Capacity>::cbegin() const {
+    return ConstIterator(_first, 0);
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+typename BTree<Key, Value, Capacity>::ConstIterator BTree<Key, Value, Capacity>::cend() const {
+    return ConstIterator(nullptr, 0);
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+std::size_t BTree<Key, Value, Capacity>::size() const {
+    return _size;
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+typename BTree<Key, Value, Capacity>::KeyCompare BTree<Key, Value, Capacity>::keyCompare() const {
+    return KeyCompare();
+}
+
+template<typename Key, typename Value, std::size_t Capacity>
+std::size_t BTree<Key, Value, Capacity>::height() const {
+    std::size_t height = 0;
+    for (const Node* node = _root; node != nullptr;
+         node = node->isLeaf ? nullptr : static_cast<const InternalNode*>(node)->children[0]) {
+        height++;
+    }
+    return height;
+}
@@ -1,33 +1,198 @@
 #pragma once
 
+#include <algorithm>
+#include <functional>
+#include <iterator>
 #include <utility>
+#include <vector>
 #include <queue>
+#include <tuple>
+#include <cstddef>
+#include <istream>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
+#include <type_traits>
+
+#include "Aggregate.h"
+#include "FrozenTree.h"
+#include "Parallel.h"
+#include "PoolAllocator.h"
+#include "Serialization.h"
+#include "Stats.h"
+
+struct NoBalance
+{
+    static constexpr bool isBalanced = false;
+};
+
+struct AvlBalance
+{
+    static constexpr bool isBalanced = true;
+};
+
+template <typename Allocator, typename = void>
+struct HasRelease : std::false_type
+{
+};
+
+template <typename Allocator>
+struct HasRelease<Allocator, std::void_t<decltype(std::declval<Allocator&>().release())>> : std::true_type
+{
+};
+
+template <typename Allocator, typename = void>
+struct HasReserve : std::false_type
+{
+};
+
+template <typename Allocator>
+struct HasReserve<Allocator, std::void_t<decltype(std::declval<Allocator&>().reserve(std::size_t()))>> : std::true_type
+{
+};
+
+// Subtree size kept in every node when order statistics are enabled.
+template <bool OrderStatistics>
+struct SubtreeSize
+{
+};
+
+template <>
+struct SubtreeSize<true>
+{
+    std::size_t subtreeSize = 1;
+};
+
+// In-order neighbour links kept in every node of a threaded tree, so that
+// iterators step in O(1) without climbing parents.
+template <bool Threaded, typename Node>
+struct InOrderLinks
+{
+};
+
+template <typename Node>
+struct InOrderLinks<true, Node>
+{
+    Node* prev = nullptr;
+    Node* next = nullptr;
+};
+
+// Aggregate of the values in a subtree, kept in every node when the
+// Aggregate policy is enabled.
+template <typename Aggregate, bool Enabled = Aggregate::enabled>
+struct SubtreeAggregate
+{
+};
 
-template <typename Key, typename Value>
-class BinarySearchTree
+template <typename Aggregate>
+struct SubtreeAggregate<Aggregate, true>
 {
-    struct Node
+    typename Aggregate::Type aggregate = Aggregate::identity();
+};
+
+template <typename Key,
+          typename Value,
+          typename Balance = AvlBalance,
+          typename Allocator = std::allocator<std::pair<Key, Value>>,
+          bool OrderStatistics = false,
+          typename Stats = NoStats,
+          typename Compare = std::less<Key>,
+          bool Threaded = false,
+          typename Aggregate = NoAggregate>
+class BinarySearchTree : private Stats
+{
+    struct Node : SubtreeSize<OrderStatistics>, InOrderLinks<Threaded, Node>, SubtreeAggregate<Aggregate>
     {
-        Node(Key key,
-             Value value,
-             Node* parent = nullptr,
-             Node* left = nullptr,
-             Node* right = nullptr);
+        template<typename... Args>
+        explicit Node(Args&&... args);
 
         std::pair<Key, Value> keyValuePair;
         Node* parent = nullptr;
         Node* left = nullptr;
         Node* right = nullptr;
+        std::size_t height = 1;
     };
 
-    void remove(const Key &key, Node* node);
+    using NodeAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<Node>;
+    using NodeAllocatorTraits = std::allocator_traits<NodeAllocator>;
+
+    template<typename... Args>
+    Node* createNode(Args&&... args);
+    void destroyNode(Node* node);
+
+    void remove(Node* node);
+    // Removes every node equal to key and returns how many there were.
+    template<typename K>
+    std::size_t eraseEqual(const K& key);
     void clear();
+    // Cursor upkeep: moves the cursors about to return node past it.
+    void advanceCursors(Node* node);
+
+    // Parks the cursors of a tree for the length of an operation that
+    // replaces or moves nodes in bulk, and resolves them back to nodes when
+    // it ends, so no cursor stays parked across later inserts and erases.
+    class CursorParking
+    {
+    public:
+        explicit CursorParking(BinarySearchTree& tree);
+        ~CursorParking();
+
+    private:
+        BinarySearchTree& _tree;
+    };
     static Node* minNode(Node* node);
     static Node* maxNode(Node* node);
+    // Recomputes the cached _min and _max after _root was replaced wholesale.
+    void updateBounds();
+    // The element before node, or the last one when node is null.
+    Node* previousNode(Node* node) const;
+
+    static std::size_t height(const Node* node);
+    static void update(Node* node);
+    void replaceChild(Node* parent, Node* oldChild, Node* newChild);
+    static Node* rotateLeft(Node* node);
+    static Node* rotateRight(Node* node);
+    static Node* balanceNode(Node* node);
+    void rebalance(Node* node);
+    void rebalanceAfterInsert(Node* node);
+
+    // Threading upkeep; all of these do nothing unless Threaded.
+    static void threadNodes(Node* const* nodes, std::size_t count);
+    static void threadSubtree(Node* root);
+    static void threadBetween(Node* left, Node* middle, Node* right);
+    static void closeThreads(Node* root);
+
+    // Lookups take any key type Compare accepts, for the transparent overloads.
+    template<typename K>
+    Node* findNode(const K& key) const;
+    template<typename K>
+    Node* lowerBoundNode(const K& key) const;
+    template<typename K>
+    Node* upperBoundNode(const K& key) const;
+
+    static std::size_t subtreeSize(const Node* node);
+    static typename Aggregate::Type subtreeAggregate(const Node* node);
+    // Aggregate of the nodes under node with keys from low up to high, which
+    // is included when inclusive.
+    typename Aggregate::Type aggregateNodes(const Node* node, const Key& low, const Key& high, bool inclusive) const;
+    static std::size_t rankOf(const Node* node);
+    template<typename NodePointer>
+    static NodePointer selectNode(NodePointer root, std::size_t index);
+    template<typename NodePointer>
+    static NodePointer advance(NodePointer node, std::ptrdiff_t offset);
 
 
 public:
+    using KeyCompare = Compare;
+
     BinarySearchTree() = default;
+    explicit BinarySearchTree(const Allocator& allocator);
+    explicit BinarySearchTree(const Compare& compare, const Allocator& allocator = Allocator());
+
+    template<typename InputIterator>
+    BinarySearchTree(InputIterator first, InputIterator last);
 
     explicit BinarySearchTree(const BinarySearchTree& other);
     BinarySearchTree& operator=(const BinarySearchTree& other);
@@ -37,15 +202,19 @@ public:
 
     ~BinarySearchTree();
 
+    // With an Aggregate, values are read-only through iterators so that the
+    // subtree aggregates stay right; change them with setValue.
+    using Element = std::conditional_t<Aggregate::enabled, const std::pair<Key, Value>, std::pair<Key, Value>>;
+
     class Iterator
     {
     public:
         explicit Iterator(Node* node);
 
-        std::pair<Key, Value>& operator*();
+        Element& operator*();
         const std::pair<Key, Value>& operator*() const;
 
-        std::pair<Key, Value>* operator->();
+        Element* operator->();
         const std::pair<Key, Value>* operator->() const;
 
         Iterator operator++();
@@ -54,11 +223,16 @@ public:
         Iterator operator--();
         Iterator operator--(int);
 
+        Iterator& operator+=(std::ptrdiff_t offset);
+        Iterator& operator-=(std::ptrdiff_t offset);
+
         bool operator==(const Iterator& other) const;
 
         bool operator!=(const Iterator& other) const;
 
     private:
+        friend class BinarySearchTree;
+
         Node* _node;
     };
 
@@ -66,6 +240,7 @@ public:
     {
     public:
         explicit ConstIterator(const Node* node);
+        ConstIterator(const Iterator& other);
 
         const std::pair<Key, Value>& operator*() const;
         const std::pair<Key, Value>* operator->() const;
@@ -76,23 +251,183 @@ public:
         ConstIterator operator--();
         ConstIterator operator--(int);
 
+        ConstIterator& operator+=(std::ptrdiff_t offset);
+        ConstIterator& operator-=(std::ptrdiff_t offset);
+
         bool operator==(const ConstIterator& other) const;
         bool operator!=(const ConstIterator& other) const;
 
     private:
+        friend class BinarySearchTree;
+
         const Node* _node;
     };
 
-    void insert(const Key& key, const Value& value);
+    // Iterator or ConstIterator walking backwards: ++ moves to the previous
+    // element. Unlike std::reverse_iterator it refers to the element it wraps,
+    // which base() returns.
+    template <typename BaseIterator>
+    class ReverseIteratorAdaptor
+    {
+    public:
+        explicit ReverseIteratorAdaptor(BaseIterator iterator);
+
+        decltype(auto) operator*() const;
+        decltype(auto) operator->() const;
+
+        ReverseIteratorAdaptor operator++();
+        ReverseIteratorAdaptor operator++(int);
+
+        ReverseIteratorAdaptor operator--();
+        ReverseIteratorAdaptor operator--(int);
+
+        bool operator==(const ReverseIteratorAdaptor& other) const;
+        bool operator!=(const ReverseIteratorAdaptor& other) const;
+
+        BaseIterator base() const;
+
+    private:
+        BaseIterator _iterator;
+    };
+
+    using ReverseIterator = ReverseIteratorAdaptor<Iterator>;
+    using ConstReverseIterator = ReverseIteratorAdaptor<ConstIterator>;
+
+    // Resumable in-order scan that, unlike an iterator, may be kept across
+    // inserts and erases made between its calls. Nodes never change identity,
+    // and the tree tracks its live cursors: erasing the element a cursor
+    // would return next moves it to the successor. Operations that replace
+    // or move many nodes at once (assignment, set algebra, split, join)
+    // note the key it stopped at and the elements with that key it already
+    // returned, and find that position again before they return; they keep
+    // or drop a run of equal keys as a whole, so it is the same element. A
+    // cursor must not outlive its tree.
+    class Cursor
+    {
+    public:
+        // Starts at the first element.
+        explicit Cursor(BinarySearchTree& tree);
+        Cursor(const Cursor& other);
+        Cursor& operator=(const Cursor& other);
+        ~Cursor();
+
+        // Moves to the first element whose key is not less than key.
+        void seek(const Key& key);
+        // Returns the next element and advances past it, or end() when done.
+        Iterator next();
+        // Calls visit on up to limit elements and returns how many it visited.
+        template<typename Visit>
+        std::size_t scan(std::size_t limit, Visit visit);
+
+    private:
+        friend class BinarySearchTree;
+
+        void attach(BinarySearchTree* tree);
+        void detach();
+        // Remembers the position by key while the tree is still intact, and
+        // finds it again once the tree is consistent.
+        void park();
+        void resume();
+
+        BinarySearchTree* _tree = nullptr;
+        Node* _next = nullptr;
+        // Set while parked: key of _next and how many elements with that key
+        // came before it.
+        std::optional<Key> _key;
+        std::size_t _equalSeen = 0;
+        bool _parked = false;
+        // Links in the tree's list of live cursors.
+        Cursor* _previousCursor = nullptr;
+        Cursor* _nextCursor = nullptr;
+    };
 
-    void erase(const Key& key);
+    // Replaces the contents with [first, last) as a perfectly balanced tree,
+    // built in O(n) when the range is sorted by key.
+    template<typename InputIterator>
+    void assign(InputIterator first, InputIterator last);
+
+    // Keys past either end are linked to the cached first or last element
+    // without a descent, so sorted streams append in O(1) amortized.
+    Iterator insert(const Key& key, const Value& value);
+    Iterator insert(Key&& key, Value&& value);
+
+    // Inserts right before hint when the key belongs there, in O(1)
+    // amortized (O(log n) with OrderStatistics, whose sizes change up to
+    // the root); otherwise inserts as insert(key, value) does.
+    Iterator insert(ConstIterator hint, const Key& key, const Value& value);
+    Iterator insert(ConstIterator hint, Key&& key, Value&& value);
+
+    template<typename... Args>
+    Iterator emplace(Args&&... args);
+
+    template<typename... Args>
+    std::pair<Iterator, bool> tryEmplace(const Key& key, Args&&... args);
+    template<typename... Args>
+    std::pair<Iterator, bool> tryEmplace(Key&& key, Args&&... args);
+    // Hinted like insert(hint, key, value); a neighbour of hint with an
+    // equal key counts as present.
+    template<typename... Args>
+    std::pair<Iterator, bool> tryEmplace(ConstIterator hint, const Key& key, Args&&... args);
+
+    // Erase relinks nodes rather than moving elements between them, so
+    // iterators to other elements stay valid. In balanced trees erase(key)
+    // cuts a run of duplicates out with two splits and a join, O(log n) plus
+    // freeing the run; NoBalance unlinks them one by one in O(k log n).
+    std::size_t erase(const Key& key);
+    Iterator erase(Iterator position);
+    Iterator erase(Iterator first, Iterator last);
 
     ConstIterator find(const Key& key) const;
     Iterator find(const Key& key);
+    bool contains(const Key& key) const;
+
+    // Overloads for keys of other types, available when Compare declares
+    // is_transparent (such as std::less<>), so that for example a
+    // std::string_view can be looked up without building a std::string.
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    std::size_t erase(const K& key);
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    ConstIterator find(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    Iterator find(const K& key);
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    bool contains(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    Iterator lowerBound(const K& key);
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    ConstIterator lowerBound(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    Iterator upperBound(const K& key);
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    ConstIterator upperBound(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    std::pair<Iterator, Iterator> equalRange(const K& key);
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    std::pair<ConstIterator, ConstIterator> equalRange(const K& key) const;
+
+    const Compare& keyCompare() const;
+
+    // out[i] becomes find(keys[i]). Descents for several keys are interleaved
+    // with prefetching, and large batches are split across threads.
+    void findBatch(const std::vector<Key>& keys, std::vector<ConstIterator>& out) const;
+    void findBatch(const std::vector<Key>& keys, std::vector<Iterator>& out);
+
+    // Inserts every pair, leaving equal keys in the order that inserting the
+    // pairs one by one would. Batches that are large relative to the tree
+    // are sorted and merged with it in a single pass that relinks all nodes.
+    void insertBatch(std::vector<std::pair<Key, Value>> keyValuePairs);
+
+    Iterator lowerBound(const Key& key);
+    ConstIterator lowerBound(const Key& key) const;
+
+    Iterator upperBound(const Key& key);
+    ConstIterator upperBound(const Key& key) const;
 
     std::pair<Iterator, Iterator> equalRange(const Key& key);
     std::pair<ConstIterator, ConstIterator> equalRange(const Key& key) const;
 
+    // The element with key holding the smallest or largest value, found by
+    // scanning the duplicates; aggregate(key) gives the value in O(log n).
     ConstIterator min(const Key& key) const;
     ConstIterator max(const Key& key) const;
 
@@ -102,33 +437,149 @@ public:
     ConstIterator cbegin() const;
     ConstIterator cend() const;
 
+    ReverseIterator rbegin();
+    ReverseIterator rend();
+
+    ConstReverseIterator crbegin() const;
+    ConstReverseIterator crend() const;
+
     std::size_t size() const;
+    std::size_t height() const;
+
+    // The Stats policy object; with TreeStats, stats().snapshot() exports
+    // the counters and histograms.
+    const Stats& stats() const;
+
+    // Set algebra by key. Runs in O(m log(n / m + 1)) for sizes m <= n by
+    // splitting and joining subtrees, on several threads for large trees.
+    // NoBalance trees may be O(n) deep, so there they walk both trees in key
+    // order instead and relink the result balanced, in O(n + m).
+    // unionWith adds the elements of other whose keys are missing here,
+    // intersect keeps the elements whose keys occur in other, and difference
+    // drops them. merge is unionWith that moves nodes out of other instead
+    // of copying them; elements whose keys were already here stay in other.
+    void unionWith(const BinarySearchTree& other);
+    void intersect(const BinarySearchTree& other);
+    void difference(const BinarySearchTree& other);
+    void merge(BinarySearchTree& other);
+
+    // Moves the elements with keys not less than key into right, replacing
+    // its contents, and keeps the rest. join appends right, whose keys must
+    // not be less than any key here, and leaves it empty. Both relink nodes
+    // in O(log n) when the allocators compare equal (for PoolAllocator, when
+    // both trees were given copies of one allocator) and copy otherwise;
+    // without OrderStatistics split also counts the smaller part. NoBalance
+    // trees may be O(n) deep, so there both relink all nodes in key order
+    // into a balanced shape instead, in O(n).
+    void split(const Key& key, BinarySearchTree& right);
+    void join(BinarySearchTree& right);
+
+    // Binary format from Serialization.h, for trivially copyable Key and
+    // Value; MappedMap reads it in place. load replaces the contents and
+    // throws std::runtime_error on a corrupt or truncated stream.
+    void save(std::ostream& out) const;
+    void load(std::istream& in);
+
+    // Immutable copy in Eytzinger order with branch-free lookups, for data
+    // that is built once and then only read.
+    FrozenTree<Key, Value, Compare> freeze() const;
+
+    // Order statistics, available when OrderStatistics is enabled.
+    std::size_t rank(const Key& key) const;
+    Iterator select(std::size_t index);
+    ConstIterator select(std::size_t index) const;
+    std::size_t countRange(const Key& low, const Key& high) const;
+
+    // Aggregate queries, available when Aggregate is enabled. They combine in
+    // key order the values with keys in [low, high), equal to key, or all of
+    // them, in O(log n).
+    typename Aggregate::Type aggregate(const Key& low, const Key& high) const;
+    typename Aggregate::Type aggregate(const Key& key) const;
+    typename Aggregate::Type aggregate() const;
+    // Replaces the value at position and refreshes the aggregates above it.
+    void setValue(Iterator position, Value value);
 
 private:
+    Iterator insertNode(Node* node);
+    Iterator insertNode(Node* node, Node* next);
+    // Links node below parent (as the root when parent is null) and restores
+    // balance, threads, bounds and size.
+    Iterator attachNode(Node* node, Node* parent, bool asLeft);
+
+    template<typename RandomIterator>
+    void build(RandomIterator first, std::size_t count);
+    static Node* link(Node* const* nodes, std::size_t count, Node* parent);
+
+    template<typename ResultIterator>
+    void findInterleaved(const Key* keys, std::size_t count, ResultIterator* out) const;
+
+    Node* detachNodes();
+    Node* cloneNode(const Node* source, Node*& spare);
+    void cloneNodes(const Node* source, Node*& spare, Node*& root);
+    void copyFrom(const Node* source, std::size_t size, Node* spare);
+    std::size_t destroyNodes(Node* node);
+    static std::size_t countNodes(const Node* node, std::size_t limit = std::numeric_limits<std::size_t>::max());
+    static std::size_t leftSize(const Node* left, const Node* right, std::size_t total);
+
+    // Join-based building blocks; they work on subtrees whose root has no parent.
+    static Node* detach(Node* node);
+    static Node* joinNodes(Node* left, Node* middle, Node* right);
+    static Node* joinSpine(Node* left, Node* middle, Node* right);
+    static Node* joinNodes(Node* left, Node* right);
+    static Node* removeMax(Node* node, Node*& max);
+    template<typename K>
+    std::pair<Node*, Node*> splitNodes(Node* node, const K& key, bool inclusive) const;
+    std::pair<Node*, Node*> unionNodes(Node* node, Node* other, std::size_t workers) const;
+    std::pair<Node*, Node*> filterNodes(Node* node, const Node* other, bool keepShared, std::size_t workers) const;
+    static bool forkable(const Node* node, std::size_t workers);
+
+    // Linear fallbacks for NoBalance, which avoid recursing over the height.
+    static std::vector<Node*> collectNodes(Node* root);
+    void relinkNodes(std::vector<Node*>& nodes);
+    void unionLinear(const BinarySearchTree& other, BinarySearchTree* source);
+    void filterLinear(const BinarySearchTree& other, bool keepShared);
+    void splitLinear(const Key& key, BinarySearchTree& right);
+    void joinLinear(BinarySearchTree& right);
+    std::vector<Node*> copyNodes(const std::vector<Node*>& nodes);
+
     std::size_t _size = 0;
     Node* _root = nullptr;
+    // First and last elements, or null when empty.
+    Node* _min = nullptr;
+    Node* _max = nullptr;
+    NodeAllocator _allocator;
+    Compare _compare;
+    // Live cursors over this tree, linked through Cursor::_nextCursor.
+    Cursor* _cursors = nullptr;
 };
 
-template<typename Key, typename Value>
-BinarySearchTree<Key, Value>::ConstIterator::ConstIterator(const BinarySearchTree::Node *node): _node(node) {
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ConstIterator::ConstIterator(const BinarySearchTree::Node *node): _node(node) {
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ConstIterator::ConstIterator(const BinarySearchTree::Iterator& other): _node(other._node) {
 }
 
-template<typename Key, typename Value>
-const std::pair<Key, Value>& BinarySearchTree<Key, Value>::ConstIterator::operator*() const {
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+const std::pair<Key, Value>& BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ConstIterator::operator*() const {
     return _node->keyValuePair;
 }
 
-template<typename Key, typename Value>
-const std::pair<Key, Value> *BinarySearchTree<Key, Value>::ConstIterator::operator->() const {
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+const std::pair<Key, Value> *BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ConstIterator::operator->() const {
     return &_node->keyValuePair;
 }
 
-template<typename Key, typename Value>
-typename BinarySearchTree<Key, Value>::ConstIterator BinarySearchTree<Key, Value>::ConstIterator::operator++() {
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ConstIterator BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ConstIterator::operator++() {
     if (_node == nullptr) {
         return *this;
     }
-    if (_node->right != nullptr) {
+    if constexpr (Threaded) {
+        _node = _node->next;
+    }
+    else if (_node->right != nullptr) {
         _node = minNode(_node->right);
     } else {
         while (_node->parent != nullptr && _node->parent->right == _node) {
@@ -139,19 +590,22 @@ typename BinarySearchTree<Key, Value>::ConstIterator BinarySearchTree<Key, Value
     return *this;
 }
 
-template<typename Key, typename Value>
-typename BinarySearchTree<Key, Value>::ConstIterator BinarySearchTree<Key, Value>::ConstIterator::operator++(int) {
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ConstIterator BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ConstIterator::operator++(int) {
     ConstIterator parent = *this;
     ++(*this);
     return parent;
 }
 
-template<typename Key, typename Value>
-typename BinarySearchTree<Key, Value>::ConstIterator BinarySearchTree<Key, Value>::ConstIterator::operator--() {
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ConstIterator BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ConstIterator::operator--() {
     if (_node == nullptr) {
         return *this;
     }
-    if (_node->left != nullptr) {
+    if constexpr (Threaded) {
+        _node = _node->prev;
+    }
+    else if (_node->left != nullptr) {
         _node = maxNode(_node->left);
     } else {
         while (_node->parent != nullptr && _node->parent->left == _node) {
@@ -162,53 +616,70 @@ typename BinarySearchTree<Key, Value>::ConstIterator BinarySearchTree<Key, Value
     return *this;
 }
 
-template<typename Key, typename Value>
-typename BinarySearchTree<Key, Value>::ConstIterator BinarySearchTree<Key, Value>::ConstIterator::operator--(int) {
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ConstIterator BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ConstIterator::operator--(int) {
     ConstIterator parent = *this;
     --(*this);
     return parent;
 }
 
-template<typename Key, typename Value>
-bool BinarySearchTree<Key, Value>::ConstIterator::operator==(const BinarySearchTree::ConstIterator &other) const {
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ConstIterator& BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ConstIterator::operator+=(std::ptrdiff_t offset) {
+    static_assert(OrderStatistics, "operator+= requires OrderStatistics");
+    if (_node != nullptr) {
+        _node = advance(_node, offset);
+    }
+    return *this;
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ConstIterator& BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ConstIterator::operator-=(std::ptrdiff_t offset) {
+    return *this += -offset;
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+bool BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ConstIterator::operator==(const BinarySearchTree::ConstIterator &other) const {
     return _node == other._node;
 }
 
-template<typename Key, typename Value>
-bool BinarySearchTree<Key, Value>::ConstIterator::operator!=(const BinarySearchTree::ConstIterator &other) const {
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+bool BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ConstIterator::operator!=(const BinarySearchTree::ConstIterator &other) const {
     return _node != other._node;
 }
 
-template<typename Key, typename Value>
-BinarySearchTree<Key, Value>::Iterator::Iterator(BinarySearchTree::Node* node): _node(node) {
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator::Iterator(BinarySearchTree::Node* node): _node(node) {
 }
 
-template<typename Key, typename Value>
-std::pair<Key, Value>& BinarySearchTree<Key, Value>::Iterator::operator*() {
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Element& BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator::operator*() {
     return _node->keyValuePair;
 }
 
-template<typename Key, typename Value>
-const std::pair<Key, Value>& BinarySearchTree<Key, Value>::Iterator::operator*() const {
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+const std::pair<Key, Value>& BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator::operator*() const {
     return _node->keyValuePair;
 }
 
-template<typename Key, typename Value>
-std::pair<Key, Value>* BinarySearchTree<Key, Value>::Iterator::operator->() {
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Element* BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator::operator->() {
     return &_node->keyValuePair;
 }
 
-template<typename Key, typename Value>
-const std::pair<Key, Value>* BinarySearchTree<Key, Value>::Iterator::operator->() const {
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+const std::pair<Key, Value>* BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator::operator->() const {
     return &_node->keyValuePair;
 }
 
-template<typename Key, typename Value>
-typename BinarySearchTree<Key, Value>::Iterator BinarySearchTree<Key, Value>::Iterator::operator++() {
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator::operator++() {
     if (_node == nullptr) {
         return *this;
     }
-    if (_node->right != nullptr) {
+    if constexpr (Threaded) {
+        _node = _node->next;
+    }
+    else if (_node->right != nullptr) {
         _node = minNode(_node->right);
     } else {
         while (_node->parent != nullptr && _node->parent->right == _node) {
@@ -219,19 +690,22 @@ typename BinarySearchTree<Key, Value>::Iterator BinarySearchTree<Key, Value>::It
     return *this;
 }
 
-template<typename Key, typename Value>
-typename BinarySearchTree<Key, Value>::Iterator BinarySearchTree<Key, Value>::Iterator::operator++(int) {
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator::operator++(int) {
     Iterator parent = *this;
     ++(*this);
     return parent;
 }
 
-template<typename Key, typename Value>
-typename BinarySearchTree<Key, Value>::Iterator BinarySearchTree<Key, Value>::Iterator::operator--() {
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator::operator--() {
     if (_node == nullptr) {
         return *this;
     }
-    if (_node->left != nullptr) {
+    if constexpr (Threaded) {
+        _node = _node->prev;
+    }
+    else if (_node->left != nullptr) {
         _node = maxNode(_node->left);
     } else {
         while (_node->parent != nullptr && _node->parent->left == _node) {
@@ -242,304 +716,2287 @@ typename BinarySearchTree<Key, Value>::Iterator BinarySearchTree<Key, Value>::It
     return *this;
 }
 
-template<typename Key, typename Value>
-typename BinarySearchTree<Key, Value>::Iterator BinarySearchTree<Key, Value>::Iterator::operator--(int) {
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator::operator--(int) {
     Iterator parent = *this;
     --(*this);
     return parent;
 }
 
-template<typename Key, typename Value>
-bool BinarySearchTree<Key, Value>::Iterator::operator!=(const BinarySearchTree::Iterator& other) const {
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator& BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator::operator+=(std::ptrdiff_t offset) {
+    static_assert(OrderStatistics, "operator+= requires OrderStatistics");
+    if (_node != nullptr) {
+        _node = advance(_node, offset);
+    }
+    return *this;
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator& BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator::operator-=(std::ptrdiff_t offset) {
+    return *this += -offset;
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+bool BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator::operator!=(const BinarySearchTree::Iterator& other) const {
     return _node != other._node;
 }
 
-template<typename Key, typename Value>
-bool BinarySearchTree<Key, Value>::Iterator::operator==(const BinarySearchTree::Iterator& other) const {
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+bool BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator::operator==(const BinarySearchTree::Iterator& other) const {
     return _node == other._node;
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::remove(const Key& key, BinarySearchTree::Node* node) {
-    if (node == nullptr)  {
-        return;
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Cursor::Cursor(BinarySearchTree& tree): _next(tree._min) {
+    attach(&tree);
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Cursor::Cursor(const Cursor& other):
+        _next(other._next), _key(other._key), _equalSeen(other._equalSeen), _parked(other._parked) {
+    attach(other._tree);
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Cursor& BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Cursor::operator=(const Cursor& other) {
+    if (this != &other) {
+        detach();
+        _next = other._next;
+        _key = other._key;
+        _equalSeen = other._equalSeen;
+        _parked = other._parked;
+        attach(other._tree);
     }
-    if (key > node->keyValuePair.first) {
-        remove(key, node->right);
+    return *this;
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Cursor::~Cursor() {
+    detach();
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+void BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Cursor::seek(const Key& key) {
+    _next = _tree->lowerBoundNode(key);
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Cursor::next() {
+    Iterator current(_next);
+    if (_next != nullptr) {
+        Iterator successor = current;
+        ++successor;
+        _next = successor._node;
     }
-    else if (key < node->keyValuePair.first) {
-        remove(key, node->left);
+    return current;
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+template<typename Visit>
+std::size_t BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Cursor::scan(std::size_t limit, Visit visit) {
+    std::size_t visited = 0;
+    for (; visited < limit; visited++) {
+        Iterator iter = next();
+        if (iter == _tree->end()) {
+            break;
+        }
+        visit(*iter);
     }
-    else {
-        if (node->left == nullptr && node->right == nullptr) {
-            if (node->parent->left == node) {
-                node->parent->left = nullptr;
-            }
-            else {
-                node->parent->right = nullptr;
-            }
-            delete node;
-            _size--;
+    return visited;
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+void BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Cursor::attach(BinarySearchTree* tree) {
+    _tree = tree;
+    if (tree != nullptr) {
+        _nextCursor = tree->_cursors;
+        if (_nextCursor != nullptr) {
+            _nextCursor->_previousCursor = this;
         }
-        else if (node->left == nullptr || node->right == nullptr) {
-            Node* nodeToDel;
-            if (node->left == nullptr) {
-                nodeToDel = node->right;
-            }
-            else {
-                nodeToDel = node->left;
-            }
-            node->keyValuePair = nodeToDel->keyValuePair;
-            node->left = nodeToDel->left;
-            node->right = nodeToDel->right;
-            if (node->right != nullptr) {
-                node->right->parent = node;
-            }
-            if (node->left != nullptr) {
-                node->left->parent = node;
-            }
-            delete nodeToDel;
-            _size--;
+        tree->_cursors = this;
+    }
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+void BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Cursor::detach() {
+    if (_tree != nullptr) {
+        if (_previousCursor != nullptr) {
+            _previousCursor->_nextCursor = _nextCursor;
         }
         else {
-            if (node->right->left == nullptr) {
-                node->keyValuePair = node->right->keyValuePair;
-                Node* newNode = node->right->right;
-                delete node->right;
-                node->right = newNode;
-                _size--;
-            }
-            else {
-                Node* curNode = minNode(node->right);
-                node->keyValuePair = curNode->keyValuePair;
-                remove(curNode->keyValuePair.first, curNode);
-            }
+            _tree->_cursors = _nextCursor;
+        }
+        if (_nextCursor != nullptr) {
+            _nextCursor->_previousCursor = _previousCursor;
         }
     }
+    _tree = nullptr;
+    _previousCursor = nullptr;
+    _nextCursor = nullptr;
 }
 
-template<typename Key, typename Value>
-BinarySearchTree<Key, Value>::BinarySearchTree(const BinarySearchTree& other) {
-    if (other._root != nullptr) {
-        for (Iterator iter = other.begin(); iter != other.end(); ++iter) {
-            insert(iter->first, iter->second);
-        }
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+void BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Cursor::park() {
+    if (_parked || _next == nullptr) {
+        return;
     }
+    _key = _next->keyValuePair.first;
+    _equalSeen = 0;
+    for (Node* node = _tree->previousNode(_next); node != nullptr && !_tree->_compare(node->keyValuePair.first, *_key);
+         node = _tree->previousNode(node)) {
+        _equalSeen++;
+    }
+    _next = nullptr;
+    _parked = true;
 }
 
-template<typename Key, typename Value>
-BinarySearchTree<Key, Value>& BinarySearchTree<Key, Value>::operator=(const BinarySearchTree& other) {
-    if (this != other) {
-        BinarySearchTree newBST(other);
-        *this = std::move(newBST);
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+void BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Cursor::resume() {
+    if (!_parked) {
+        return;
     }
-    return *this;
+    // Skip the elements with the key that were already returned.
+    Iterator position(_tree->lowerBoundNode(*_key));
+    for (std::size_t skipped = 0; skipped < _equalSeen && position != _tree->end() &&
+                                  !_tree->_compare(*_key, position->first); skipped++) {
+        ++position;
+    }
+    _next = position._node;
+    _key.reset();
+    _parked = false;
 }
 
-template<typename Key, typename Value>
-BinarySearchTree<Key, Value>::BinarySearchTree(BinarySearchTree&& other) noexcept {
-    *this = std::move(other);
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+void BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::advanceCursors(BinarySearchTree::Node* node) {
+    for (Cursor* cursor = _cursors; cursor != nullptr; cursor = cursor->_nextCursor) {
+        if (cursor->_next == node) {
+            Iterator successor(node);
+            ++successor;
+            cursor->_next = successor._node;
+        }
+    }
 }
 
-template<typename Key, typename Value>
-BinarySearchTree<Key, Value>& BinarySearchTree<Key, Value>::operator=(BinarySearchTree&& other) noexcept {
-    if (this != &other) {
-        clear();
-        std::swap(this->_root, other._root);
-        std::swap(this->_size, other._size);
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::CursorParking::CursorParking(BinarySearchTree& tree): _tree(tree) {
+    for (Cursor* cursor = tree._cursors; cursor != nullptr; cursor = cursor->_nextCursor) {
+        cursor->park();
     }
-    return *this;
 }
 
-template<typename Key, typename Value>
-BinarySearchTree<Key, Value>::~BinarySearchTree() {
-    clear();
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::CursorParking::~CursorParking() {
+    for (Cursor* cursor = _tree._cursors; cursor != nullptr; cursor = cursor->_nextCursor) {
+        cursor->resume();
+    }
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::insert(const Key& key, const Value& value) {
-    if (_root != nullptr) {
-        Node* curNode = _root;
-        Key curKey = curNode->keyValuePair.first;
-        while ((curKey >= key && curNode->left != nullptr)
-               || (curKey < key && curNode->right != nullptr)) {
-            curNode = curKey >= key ? curNode->left: curNode->right;
-            curKey = curNode->keyValuePair.first;
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+void BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::remove(BinarySearchTree::Node* node) {
+    advanceCursors(node);
+    if (node == _min) {
+        _min = node->right != nullptr ? minNode(node->right) : node->parent;
+    }
+    if (node == _max) {
+        _max = node->left != nullptr ? maxNode(node->left) : node->parent;
+    }
+    if constexpr (Threaded) {
+        if (node->prev != nullptr) {
+            node->prev->next = node->next;
+        }
+        if (node->next != nullptr) {
+            node->next->prev = node->prev;
+        }
+    }
+    Node* fixFrom;
+    if (node->left != nullptr && node->right != nullptr) {
+        Node* successor = minNode(node->right);
+        if (successor->parent == node) {
+            fixFrom = successor;
+        }
+        else {
+            fixFrom = successor->parent;
+            replaceChild(successor->parent, successor, successor->right);
+            successor->right = node->right;
+            successor->right->parent = successor;
         }
-        (curKey >= key? curNode->left: curNode->right) = new Node(key, value, curNode);
+        replaceChild(node->parent, node, successor);
+        successor->left = node->left;
+        successor->left->parent = successor;
     }
     else {
-        _root = new Node(key, value);
+        fixFrom = node->parent;
+        replaceChild(node->parent, node, node->left != nullptr ? node->left : node->right);
     }
-    _size++;
+    destroyNode(node);
+    _size--;
+    rebalance(fixFrom);
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::erase(const Key& key) {
-    while (find(key) != end()) {
-        remove(key, _root);
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+template<typename... Args>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Node*
+        BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::createNode(Args&&... args) {
+    Node* node = NodeAllocatorTraits::allocate(_allocator, 1);
+    try {
+        NodeAllocatorTraits::construct(_allocator, node, std::forward<Args>(args)...);
+    }
+    catch (...) {
+        NodeAllocatorTraits::deallocate(_allocator, node, 1);
+        throw;
+    }
+    if constexpr (Stats::enabled) {
+        Stats::recordAllocation();
     }
+    return node;
 }
 
-template<typename Key, typename Value>
-typename BinarySearchTree<Key, Value>::ConstIterator BinarySearchTree<Key, Value>::find(const Key& key) const {
-    Node* curNode = _root;
-    while(curNode != nullptr) {
-        if (curNode->keyValuePair.first == key) {
-            break;
-        }
-        curNode = curNode->keyValuePair.first > key? curNode->left: curNode->right;
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+void BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::destroyNode(BinarySearchTree::Node* node) {
+    NodeAllocatorTraits::destroy(_allocator, node);
+    NodeAllocatorTraits::deallocate(_allocator, node, 1);
+    if constexpr (Stats::enabled) {
+        Stats::recordDeallocation();
     }
-    return ConstIterator(curNode);
 }
 
-template<typename Key, typename Value>
-typename BinarySearchTree<Key, Value>::Iterator BinarySearchTree<Key, Value>::find(const Key& key) {
+// Node with a key equivalent to key, or nullptr.
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+template<typename K>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Node*
+        BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::findNode(const K& key) const {
     Node* curNode = _root;
+    std::size_t visits = 0;
+    std::size_t comparisons = 0;
     while (curNode != nullptr) {
-        if (curNode->keyValuePair.first > key) {
-            if (curNode->left == nullptr) {
-                return Iterator(nullptr);
-            }
+        visits++;
+        comparisons++;
+        if (_compare(key, curNode->keyValuePair.first)) {
             curNode = curNode->left;
+            continue;
         }
-        else if (curNode->keyValuePair.first < key){
-            if (curNode->right == nullptr) {
-                return Iterator(nullptr);
-            }
+        comparisons++;
+        if (_compare(curNode->keyValuePair.first, key)) {
+            curNode = curNode->right;
+            continue;
+        }
+        break;
+    }
+    if constexpr (Stats::enabled) {
+        Stats::recordDescent(visits, comparisons);
+    }
+    return curNode;
+}
+
+// Leftmost node whose key is not less than key, or nullptr.
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+template<typename K>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Node*
+        BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::lowerBoundNode(const K& key) const {
+    Node* bound = nullptr;
+    Node* curNode = _root;
+    std::size_t visits = 0;
+    while (curNode != nullptr) {
+        visits++;
+        if (_compare(curNode->keyValuePair.first, key)) {
             curNode = curNode->right;
         }
         else {
-            break;
+            bound = curNode;
+            curNode = curNode->left;
         }
     }
-    return Iterator(curNode);
+    if constexpr (Stats::enabled) {
+        Stats::recordDescent(visits, visits);
+    }
+    return bound;
 }
 
-template<typename Key, typename Value>
-std::pair<typename BinarySearchTree<Key, Value>::Iterator, typename BinarySearchTree<Key, Value>::Iterator>
-        BinarySearchTree<Key, Value>::equalRange(const Key& key) {
-    Iterator start = find(key);
-    Iterator stop(start);
-    if (start == end()) {
-        return std::make_pair(start, stop);
-    }
-    if (begin()->first == key) {
-        return std::make_pair(begin(), ++stop);
+// Leftmost node whose key is greater than key, or nullptr.
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+template<typename K>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Node*
+        BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::upperBoundNode(const K& key) const {
+    Node* bound = nullptr;
+    Node* curNode = _root;
+    std::size_t visits = 0;
+    while (curNode != nullptr) {
+        visits++;
+        if (_compare(key, curNode->keyValuePair.first)) {
+            bound = curNode;
+            curNode = curNode->left;
+        }
+        else {
+            curNode = curNode->right;
+        }
     }
-    while (start != begin() && start->first == key) {
-        --start;
+    if constexpr (Stats::enabled) {
+        Stats::recordDescent(visits, visits);
     }
-    return std::make_pair(++start, ++stop);
+    return bound;
 }
 
-template<typename Key, typename Value>
-std::pair<typename BinarySearchTree<Key, Value>::ConstIterator, typename BinarySearchTree<Key, Value>::ConstIterator>
-        BinarySearchTree<Key, Value>::equalRange(const Key& key) const {
-    ConstIterator start = find(key);
-    ConstIterator stop(start);
-    if (start == cend()) {
-        return std::make_pair(start, stop);
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+std::size_t BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::subtreeSize(const BinarySearchTree::Node* node) {
+    if constexpr (OrderStatistics) {
+        return node != nullptr ? node->subtreeSize : 0;
     }
-    if (cbegin()->first == key) {
-        return std::make_pair(cbegin(), ++stop);
+    else {
+        return 0;
+    }
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename Aggregate::Type BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::subtreeAggregate(const BinarySearchTree::Node* node) {
+    if constexpr (Aggregate::enabled) {
+        return node != nullptr ? node->aggregate : Aggregate::identity();
     }
-    while (start != cbegin() && start->first == key) {
-        --start;
+    else {
+        return {};
     }
-    return std::make_pair(++start, ++stop);
 }
 
-template<typename Key, typename Value>
-typename BinarySearchTree<Key, Value>::ConstIterator BinarySearchTree<Key, Value>::min(const Key& key) const {
-    std::pair<ConstIterator, ConstIterator> keyValues = equalRange(key);
-    ConstIterator minPairIterator = ConstIterator(keyValues.first);
-    for (ConstIterator iterator = keyValues.first; iterator != keyValues.second; ++iterator) {
-        if (iterator->second < minPairIterator->second) {
-            minPairIterator = iterator;
+// In-order index of node, found by climbing to the root.
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+std::size_t BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::rankOf(const BinarySearchTree::Node* node) {
+    std::size_t index = subtreeSize(node->left);
+    while (node->parent != nullptr) {
+        if (node->parent->right == node) {
+            index += subtreeSize(node->parent->left) + 1;
         }
+        node = node->parent;
     }
-    return minPairIterator;
+    return index;
 }
 
-template<typename Key, typename Value>
-typename BinarySearchTree<Key, Value>::ConstIterator BinarySearchTree<Key, Value>::max(const Key& key) const {
-    std::pair<ConstIterator, ConstIterator> keyValues = equalRange(key);
-    ConstIterator maxPairIterator = ConstIterator(keyValues.first);
-    for (ConstIterator iterator = keyValues.first; iterator != keyValues.second; ++iterator) {
-        if (iterator->second > maxPairIterator->second) {
-            maxPairIterator = iterator;
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+template<typename NodePointer>
+NodePointer BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::selectNode(NodePointer root, std::size_t index) {
+    NodePointer curNode = root;
+    while (curNode != nullptr) {
+        std::size_t leftSize = subtreeSize(curNode->left);
+        if (index < leftSize) {
+            curNode = curNode->left;
+        }
+        else if (index == leftSize) {
+            break;
+        }
+        else {
+            index -= leftSize + 1;
+            curNode = curNode->right;
         }
     }
-    return maxPairIterator;
+    return curNode;
 }
 
-template<typename Key, typename Value>
-typename BinarySearchTree<Key, Value>::Iterator BinarySearchTree<Key, Value>::begin() {
-    return BinarySearchTree::Iterator(minNode(_root));
+// Node offset positions away from node in in-order, or nullptr past either end.
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+template<typename NodePointer>
+NodePointer BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::advance(NodePointer node, std::ptrdiff_t offset) {
+    std::ptrdiff_t index = static_cast<std::ptrdiff_t>(rankOf(node)) + offset;
+    NodePointer root = node;
+    while (root->parent != nullptr) {
+        root = root->parent;
+    }
+    if (index < 0) {
+        return nullptr;
+    }
+    return selectNode(root, static_cast<std::size_t>(index));
 }
 
-template<typename Key, typename Value>
-typename BinarySearchTree<Key, Value>::Iterator BinarySearchTree<Key, Value>::end() {
-    return BinarySearchTree::Iterator(nullptr);
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+std::size_t BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::height(const BinarySearchTree::Node* node) {
+    return node != nullptr ? node->height : 0;
 }
 
-template<typename Key, typename Value>
-typename BinarySearchTree<Key, Value>::ConstIterator BinarySearchTree<Key, Value>::cbegin() const {
-    return BinarySearchTree::ConstIterator(minNode(_root));
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+void BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::update(BinarySearchTree::Node* node) {
+    node->height = 1 + std::max(height(node->left), height(node->right));
+    if constexpr (OrderStatistics) {
+        node->subtreeSize = 1 + subtreeSize(node->left) + subtreeSize(node->right);
+    }
+    if constexpr (Aggregate::enabled) {
+        node->aggregate = Aggregate::combine(Aggregate::combine(subtreeAggregate(node->left),
+                                                                Aggregate::lift(node->keyValuePair.second)),
+                                             subtreeAggregate(node->right));
+    }
 }
 
-template<typename Key, typename Value>
-typename BinarySearchTree<Key, Value>::ConstIterator BinarySearchTree<Key, Value>::cend() const {
-    return BinarySearchTree::ConstIterator(nullptr);
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+void BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::replaceChild(BinarySearchTree::Node* parent,
+                                                         BinarySearchTree::Node* oldChild,
+                                                         BinarySearchTree::Node* newChild) {
+    if (parent == nullptr) {
+        _root = newChild;
+    }
+    else if (parent->left == oldChild) {
+        parent->left = newChild;
+    }
+    else {
+        parent->right = newChild;
+    }
+    if (newChild != nullptr) {
+        newChild->parent = parent;
+    }
 }
 
-template<typename Key, typename Value>
-std::size_t BinarySearchTree<Key, Value>::size() const {
-    return _size;
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Node*
+        BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::rotateLeft(BinarySearchTree::Node* node) {
+    Node* pivot = node->right;
+    node->right = pivot->left;
+    if (pivot->left != nullptr) {
+        pivot->left->parent = node;
+    }
+    pivot->parent = node->parent;
+    if (node->parent != nullptr) {
+        (node->parent->left == node ? node->parent->left : node->parent->right) = pivot;
+    }
+    pivot->left = node;
+    node->parent = pivot;
+    update(node);
+    update(pivot);
+    return pivot;
 }
 
-template<typename Key, typename Value>
-typename BinarySearchTree<Key, Value>::Node* BinarySearchTree<Key, Value>::minNode(BinarySearchTree::Node* node) {
-    auto сurNode = node;
-    while (сurNode->left != nullptr) {
-        сurNode = сurNode->left;
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Node*
+        BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::rotateRight(BinarySearchTree::Node* node) {
+    Node* pivot = node->left;
+    node->left = pivot->right;
+    if (pivot->right != nullptr) {
+        pivot->right->parent = node;
     }
-    return сurNode;
+    pivot->parent = node->parent;
+    if (node->parent != nullptr) {
+        (node->parent->left == node ? node->parent->left : node->parent->right) = pivot;
+    }
+    pivot->right = node;
+    node->parent = pivot;
+    update(node);
+    update(pivot);
+    return pivot;
 }
 
-template<typename Key, typename Value>
-typename BinarySearchTree<Key, Value>::Node* BinarySearchTree<Key, Value>::maxNode(BinarySearchTree::Node* node) {
-    auto сurNode = node;
-    while (сurNode->right != nullptr) {
-        сurNode = сurNode->right;
+// Updates node and, when Balance requires it, restores the AVL invariant
+// there with at most two rotations. Returns the subtree's new root.
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Node*
+        BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::balanceNode(BinarySearchTree::Node* node) {
+    update(node);
+    if constexpr (Balance::isBalanced) {
+        if (height(node->left) > height(node->right) + 1) {
+            if (height(node->left->left) < height(node->left->right)) {
+                rotateLeft(node->left);
+            }
+            node = rotateRight(node);
+        }
+        else if (height(node->right) > height(node->left) + 1) {
+            if (height(node->right->right) < height(node->right->left)) {
+                rotateRight(node->right);
+            }
+            node = rotateLeft(node);
+        }
     }
-    return сurNode;
+    return node;
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clear() {
-    if (_root != nullptr) {
-        std::queue<Node*> children;
-        children.push(_root);
-        while (!children.empty()) {
-            Node* curNode = children.front();
-            if (curNode->left != nullptr) {
-                children.push(curNode->left);
+// Restores node heights (and the AVL invariant when Balance requires it)
+// on the path from node up to the root.
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+void BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::rebalance(BinarySearchTree::Node* node) {
+    while (node != nullptr) {
+        node = balanceNode(node);
+        if (node->parent == nullptr) {
+            _root = node;
+        }
+        node = node->parent;
+    }
+}
+
+// rebalance for the parent of a new leaf: once a subtree is back at its old
+// height nothing above it changes, unless sizes or aggregates need fixing.
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+void BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::rebalanceAfterInsert(BinarySearchTree::Node* node) {
+    while (node != nullptr) {
+        std::size_t oldHeight = node->height;
+        node = balanceNode(node);
+        if (node->parent == nullptr) {
+            _root = node;
+        }
+        if constexpr (!OrderStatistics && !Aggregate::enabled) {
+            if (node->height == oldHeight) {
+                return;
+            }
+        }
+        node = node->parent;
+    }
+}
+
+// Links nodes, which are in key order, into one thread.
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+void BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::threadNodes(Node* const* nodes, std::size_t count) {
+    if constexpr (Threaded) {
+        for (std::size_t i = 0; i < count; i++) {
+            nodes[i]->prev = i > 0 ? nodes[i - 1] : nullptr;
+            nodes[i]->next = i + 1 < count ? nodes[i + 1] : nullptr;
+        }
+    }
+}
+
+// Rebuilds the thread of a subtree whose links are stale, finding each
+// successor through the tree shape.
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+void BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::threadSubtree(BinarySearchTree::Node* root) {
+    if constexpr (Threaded) {
+        if (root == nullptr) {
+            return;
+        }
+        Node* prev = nullptr;
+        Node* curNode = minNode(root);
+        while (curNode != nullptr) {
+            curNode->prev = prev;
+            if (prev != nullptr) {
+                prev->next = curNode;
             }
+            prev = curNode;
             if (curNode->right != nullptr) {
-                children.push(curNode->right);
+                curNode = minNode(curNode->right);
+            }
+            else {
+                while (curNode != root && curNode->parent->right == curNode) {
+                    curNode = curNode->parent;
+                }
+                curNode = curNode != root ? curNode->parent : nullptr;
             }
-            delete curNode;
-            children.pop();
         }
+        prev->next = nullptr;
     }
-    _size = 0;
 }
 
-template<typename Key, typename Value>
-BinarySearchTree<Key, Value>::Node::Node(Key key, Value value, BinarySearchTree::Node* parent,
-                                         BinarySearchTree::Node* left, BinarySearchTree::Node* right):
-                                         keyValuePair(std::make_pair(key, value)),
-                                         parent(parent), left(left), right(right) {
-                                         }
\ No newline at end of file
+// Places middle between left and right in the thread; either side may be null.
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+void BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::threadBetween(BinarySearchTree::Node* left, BinarySearchTree::Node* middle,
+                                                        BinarySearchTree::Node* right) {
+    if constexpr (Threaded) {
+        middle->prev = left;
+        middle->next = right;
+        if (left != nullptr) {
+            left->next = middle;
+        }
+        if (right != nullptr) {
+            right->prev = middle;
+        }
+    }
+}
+
+// Cuts the thread at both ends of the tree under root.
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+void BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::closeThreads(BinarySearchTree::Node* root) {
+    if constexpr (Threaded) {
+        if (root != nullptr) {
+            minNode(root)->prev = nullptr;
+            maxNode(root)->next = nullptr;
+        }
+    }
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::BinarySearchTree(const Allocator& allocator): _allocator(allocator) {
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::BinarySearchTree(const Compare& compare, const Allocator& allocator):
+        _allocator(allocator), _compare(compare) {
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+template<typename InputIterator>
+BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::BinarySearchTree(InputIterator first, InputIterator last) {
+    assign(first, last);
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::BinarySearchTree(const BinarySearchTree& other):
+        _allocator(NodeAllocatorTraits::select_on_container_copy_construction(other._allocator)),
+        _compare(other._compare) {
+    copyFrom(other._root, other._size, nullptr);
+}
+
+// Reuses this tree's nodes for the copy; if copying throws, this tree is left empty.
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>& BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::operator=(const BinarySearchTree& other) {
+    if (this != &other) {
+        CursorParking parking(*this);
+        Node* spare = detachNodes();
+        _compare = other._compare;
+        copyFrom(other._root, other._size, spare);
+    }
+    return *this;
+}
+
+// Strips the tree leaf by leaf into a list linked through right and leaves
+// the tree empty.
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Node* BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::detachNodes() {
+    Node* spare = nullptr;
+    Node* curNode = _root;
+    while (curNode != nullptr) {
+        if (curNode->left != nullptr) {
+            curNode = curNode->left;
+        }
+        else if (curNode->right != nullptr) {
+            curNode = curNode->right;
+        }
+        else {
+            Node* parent = curNode->parent;
+            if (parent != nullptr) {
+                (parent->left == curNode ? parent->left : parent->right) = nullptr;
+            }
+            curNode->right = spare;
+            spare = curNode;
+            curNode = parent;
+        }
+    }
+    _root = nullptr;
+    _min = nullptr;
+    _max = nullptr;
+    _size = 0;
+    return spare;
+}
+
+// Copy of source without links, taken from the spare list when possible.
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Node* BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::cloneNode(const BinarySearchTree::Node* source,
+                                                 BinarySearchTree::Node*& spare) {
+    Node* node;
+    if (spare != nullptr) {
+        node = spare;
+        node->keyValuePair = source->keyValuePair;
+        spare = spare->right;
+    }
+    else {
+        node = createNode(source->keyValuePair);
+    }
+    node->parent = nullptr;
+    node->left = nullptr;
+    node->right = nullptr;
+    node->height = source->height;
+    if constexpr (OrderStatistics) {
+        node->subtreeSize = source->subtreeSize;
+    }
+    if constexpr (Aggregate::enabled) {
+        node->aggregate = source->aggregate;
+    }
+    return node;
+}
+
+// Copies the subtree under source into root with the same shape, walking
+// both trees in lockstep through parent links. If copying throws, root holds
+// the nodes copied so far.
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+void BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::cloneNodes(const BinarySearchTree::Node* source, BinarySearchTree::Node*& spare,
+                                                   BinarySearchTree::Node*& root) {
+    const Node* top = source;
+    root = cloneNode(source, spare);
+    Node* copy = root;
+    while (copy != nullptr) {
+        if (source->left != nullptr && copy->left == nullptr) {
+            copy->left = cloneNode(source->left, spare);
+            copy->left->parent = copy;
+            source = source->left;
+            copy = copy->left;
+        }
+        else if (source->right != nullptr && copy->right == nullptr) {
+            copy->right = cloneNode(source->right, spare);
+            copy->right->parent = copy;
+            source = source->right;
+            copy = copy->right;
+        }
+        else {
+            source = source != top ? source->parent : nullptr;
+            copy = copy->parent;
+        }
+    }
+    threadSubtree(root);
+}
+
+// Replaces the (empty) tree with a copy of the same shape as source.
+// Leftover spare nodes are freed.
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+void BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::copyFrom(const BinarySearchTree::Node* source, std::size_t size, BinarySearchTree::Node* spare) {
+    try {
+        if (source != nullptr) {
+            if constexpr (HasReserve<NodeAllocator>::value) {
+                if (spare == nullptr) {
+                    _allocator.reserve(size);
+                }
+            }
+            cloneNodes(source, spare, _root);
+        }
+        updateBounds();
+        _size = size;
+    }
+    catch (...) {
+        clear();
+        while (spare != nullptr) {
+            Node* next = spare->right;
+            destroyNode(spare);
+            spare = next;
+        }
+        throw;
+    }
+    while (spare != nullptr) {
+        Node* next = spare->right;
+        destroyNode(spare);
+        spare = next;
+    }
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::BinarySearchTree(BinarySearchTree&& other) noexcept: _compare(other._compare) {
+    *this = std::move(other);
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>& BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::operator=(BinarySearchTree&& other) noexcept {
+    if (this != &other) {
+        CursorParking parking(*this);
+        CursorParking otherParking(other);
+        clear();
+        std::swap(this->_root, other._root);
+        std::swap(this->_min, other._min);
+        std::swap(this->_max, other._max);
+        std::swap(this->_size, other._size);
+        std::swap(this->_allocator, other._allocator);
+        std::swap(this->_compare, other._compare);
+    }
+    return *this;
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::~BinarySearchTree() {
+    while (_cursors != nullptr) {
+        _cursors->detach();
+    }
+    clear();
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator
+        BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::insertNode(BinarySearchTree::Node* node) {
+    const Key& key = node->keyValuePair.first;
+    if (_root == nullptr) {
+        return attachNode(node, nullptr, false);
+    }
+    if (_compare(_max->keyValuePair.first, key)) {
+        if constexpr (Stats::enabled) {
+            Stats::recordDescent(1, 1);
+        }
+        return attachNode(node, _max, false);
+    }
+    if (!_compare(_min->keyValuePair.first, key)) {
+        if constexpr (Stats::enabled) {
+            Stats::recordDescent(1, 2);
+        }
+        return attachNode(node, _min, true);
+    }
+    Node* curNode = _root;
+    std::size_t visits = 1;
+    bool asLeft;
+    while (true) {
+        asLeft = !_compare(curNode->keyValuePair.first, key);
+        Node* child = asLeft ? curNode->left : curNode->right;
+        if (child == nullptr) {
+            break;
+        }
+        curNode = child;
+        visits++;
+    }
+    if constexpr (Stats::enabled) {
+        Stats::recordDescent(visits, visits + 2);
+    }
+    return attachNode(node, curNode, asLeft);
+}
+
+// Hangs node in the gap before next (null for the end) when its key fits
+// there: as the left child of next, or else as the right child of the
+// element before it, which then has none.
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator
+        BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::insertNode(BinarySearchTree::Node* node, BinarySearchTree::Node* next) {
+    const Key& key = node->keyValuePair.first;
+    Node* previous = previousNode(next);
+    if ((next == nullptr || !_compare(next->keyValuePair.first, key)) &&
+        (previous == nullptr || !_compare(key, previous->keyValuePair.first))) {
+        if (next != nullptr && next->left == nullptr) {
+            return attachNode(node, next, true);
+        }
+        return attachNode(node, previous, false);
+    }
+    return insertNode(node);
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator
+        BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::attachNode(BinarySearchTree::Node* node, BinarySearchTree::Node* parent, bool asLeft) {
+    if constexpr (Aggregate::enabled) {
+        update(node);
+    }
+    if (parent == nullptr) {
+        _root = node;
+        _min = node;
+        _max = node;
+    }
+    else {
+        (asLeft ? parent->left : parent->right) = node;
+        node->parent = parent;
+        if constexpr (Threaded) {
+            if (asLeft) {
+                threadBetween(parent->prev, node, parent);
+            }
+            else {
+                threadBetween(parent, node, parent->next);
+            }
+        }
+        if (asLeft && parent == _min) {
+            _min = node;
+        }
+        else if (!asLeft && parent == _max) {
+            _max = node;
+        }
+        rebalanceAfterInsert(parent);
+    }
+    _size++;
+    return Iterator(node);
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+template<typename InputIterator>
+void BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::assign(InputIterator first, InputIterator last) {
+    CursorParking parking(*this);
+    clear();
+    auto keyLess = [this](const auto& left, const auto& right) {
+        return _compare(left.first, right.first);
+    };
+    using Category = typename std::iterator_traits<InputIterator>::iterator_category;
+    if constexpr (std::is_base_of_v<std::random_access_iterator_tag, Category>) {
+        if (std::is_sorted(first, last, keyLess)) {
+            build(first, last - first);
+            return;
+        }
+    }
+    std::vector<std::pair<Key, Value>> entries(first, last);
+    if (!std::is_sorted(entries.begin(), entries.end(), keyLess)) {
+        parallelStableSort(entries.begin(), entries.end(), keyLess);
+    }
+    build(std::make_move_iterator(entries.begin()), entries.size());
+}
+
+// Creates all nodes in key order (from one chunk when the allocator supports
+// reserve) and then links them into a balanced shape without allocating.
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+template<typename RandomIterator>
+void BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::build(RandomIterator first, std::size_t count) {
+    if constexpr (HasReserve<NodeAllocator>::value) {
+        _allocator.reserve(count);
+    }
+    std::vector<Node*> nodes;
+    nodes.reserve(count);
+    try {
+        for (std::size_t i = 0; i < count; i++) {
+            nodes.push_back(createNode(first[i]));
+        }
+    }
+    catch (...) {
+        for (Node* node : nodes) {
+            destroyNode(node);
+        }
+        throw;
+    }
+    threadNodes(nodes.data(), count);
+    _root = link(nodes.data(), count, nullptr);
+    updateBounds();
+    _size = count;
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Node* BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::link(Node* const* nodes, std::size_t count, BinarySearchTree::Node* parent) {
+    if (count == 0) {
+        return nullptr;
+    }
+    std::size_t middle = count / 2;
+    Node* node = nodes[middle];
+    node->parent = parent;
+    node->left = link(nodes, middle, node);
+    node->right = link(nodes + middle + 1, count - middle - 1, node);
+    update(node);
+    return node;
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Node* BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::detach(BinarySearchTree::Node* node) {
+    if (node != nullptr) {
+        node->parent = nullptr;
+    }
+    return node;
+}
+
+// Joins left, middle and right, whose keys are ordered in that sequence.
+// With AVL balancing middle is hung off the spine of the taller side at
+// the height of the other one, so only O(|height(left) - height(right)|)
+// nodes are rebalanced. Threads are linked through middle; the outermost
+// ones may still point into other trees until closeThreads.
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Node* BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::joinNodes(BinarySearchTree::Node* left, BinarySearchTree::Node* middle,
+                                                    BinarySearchTree::Node* right) {
+    if constexpr (Threaded) {
+        threadBetween(left != nullptr ? maxNode(left) : nullptr, middle, right != nullptr ? minNode(right) : nullptr);
+    }
+    return joinSpine(left, middle, right);
+}
+
+// The shape part of joinNodes, which leaves threads alone.
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Node* BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::joinSpine(BinarySearchTree::Node* left, BinarySearchTree::Node* middle,
+                                                    BinarySearchTree::Node* right) {
+    if constexpr (Balance::isBalanced) {
+        if (height(left) > height(right) + 1) {
+            left->right = joinSpine(detach(left->right), middle, right);
+            left->right->parent = left;
+            return balanceNode(left);
+        }
+        if (height(right) > height(left) + 1) {
+            right->left = joinSpine(left, middle, detach(right->left));
+            right->left->parent = right;
+            return balanceNode(right);
+        }
+    }
+    middle->parent = nullptr;
+    middle->left = left;
+    middle->right = right;
+    if (left != nullptr) {
+        left->parent = middle;
+    }
+    if (right != nullptr) {
+        right->parent = middle;
+    }
+    update(middle);
+    return middle;
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Node* BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::joinNodes(BinarySearchTree::Node* left, BinarySearchTree::Node* right) {
+    if (left == nullptr) {
+        return right;
+    }
+    if (right == nullptr) {
+        return left;
+    }
+    Node* max;
+    left = removeMax(left, max);
+    return joinNodes(left, max, right);
+}
+
+// Unlinks the largest node of the subtree into max and returns the rest.
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Node* BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::removeMax(BinarySearchTree::Node* node, BinarySearchTree::Node*& max) {
+    if (node->right == nullptr) {
+        max = node;
+        return detach(node->left);
+    }
+    Node* rest = removeMax(detach(node->right), max);
+    return joinNodes(detach(node->left), node, rest);
+}
+
+// Splits the subtree into the nodes ordered before key and the rest. With
+// inclusive, nodes equal to key go to the first part.
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+template<typename K>
+std::pair<typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Node*, typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Node*> BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::splitNodes(BinarySearchTree::Node* node, const K& key, bool inclusive) const {
+    if (node == nullptr) {
+        return std::make_pair(nullptr, nullptr);
+    }
+    Node* left = detach(node->left);
+    Node* right = detach(node->right);
+    if (inclusive ? !_compare(key, node->keyValuePair.first) : _compare(node->keyValuePair.first, key)) {
+        std::pair<Node*, Node*> parts = splitNodes(right, key, inclusive);
+        return std::make_pair(joinNodes(left, node, parts.first), parts.second);
+    }
+    std::pair<Node*, Node*> parts = splitNodes(left, key, inclusive);
+    return std::make_pair(parts.first, joinNodes(parts.second, node, right));
+}
+
+// Forks only while workers remain and the subtree is above parallelThreshold
+// (judged by height, which every node keeps).
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+bool BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::forkable(const BinarySearchTree::Node* node, std::size_t workers) {
+    return workers > 1 && (std::size_t(1) << std::min<std::size_t>(height(node), 63)) > parallelThreshold;
+}
+
+// Returns the union of node and other, and the nodes of other whose keys
+// were already in node. Recurses on node's shape, splitting other at each key.
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+std::pair<typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Node*, typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Node*> BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::unionNodes(BinarySearchTree::Node* node, BinarySearchTree::Node* other, std::size_t workers) const {
+    if (node == nullptr || other == nullptr) {
+        return std::make_pair(node != nullptr ? node : other, nullptr);
+    }
+    const Key& key = node->keyValuePair.first;
+    std::pair<Node*, Node*> less = splitNodes(other, key, false);
+    std::pair<Node*, Node*> equal = splitNodes(less.second, key, true);
+    Node* left = detach(node->left);
+    Node* right = detach(node->right);
+    std::pair<Node*, Node*> leftUnion;
+    std::pair<Node*, Node*> rightUnion;
+    parallelInvoke(forkable(node, workers),
+                   [&] { leftUnion = unionNodes(left, less.first, workers / 2); },
+                   [&] { rightUnion = unionNodes(right, equal.second, workers - workers / 2); });
+    return std::make_pair(joinNodes(leftUnion.first, node, rightUnion.first),
+                          joinNodes(leftUnion.second, joinNodes(equal.first, rightUnion.second)));
+}
+
+// Returns the nodes of node whose keys occur in other (or, without keepShared,
+// do not occur there) and the dropped rest. Recurses on other's shape,
+// splitting node at each key.
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+std::pair<typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Node*, typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Node*> BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::filterNodes(BinarySearchTree::Node* node, const BinarySearchTree::Node* other,
+                                                      bool keepShared, std::size_t workers) const {
+    if (node == nullptr || other == nullptr) {
+        return keepShared ? std::pair<Node*, Node*>(nullptr, node) : std::pair<Node*, Node*>(node, nullptr);
+    }
+    const Key& key = other->keyValuePair.first;
+    bool fork = forkable(node, workers);
+    std::pair<Node*, Node*> less = splitNodes(node, key, false);
+    std::pair<Node*, Node*> equal = splitNodes(less.second, key, true);
+    std::pair<Node*, Node*> leftPart;
+    std::pair<Node*, Node*> rightPart;
+    parallelInvoke(fork,
+                   [&] { leftPart = filterNodes(less.first, other->left, keepShared, workers / 2); },
+                   [&] { rightPart = filterNodes(equal.second, other->right, keepShared, workers - workers / 2); });
+    Node* kept = keepShared ? equal.first : nullptr;
+    Node* dropped = keepShared ? nullptr : equal.first;
+    return std::make_pair(joinNodes(leftPart.first, joinNodes(kept, rightPart.first)),
+                          joinNodes(leftPart.second, joinNodes(dropped, rightPart.second)));
+}
+
+// The nodes of the subtree under root in key order, walked with an explicit
+// stack so that the depth does not matter.
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+std::vector<typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Node*> BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::collectNodes(BinarySearchTree::Node* root) {
+    std::vector<Node*> nodes;
+    std::vector<Node*> pending;
+    Node* curNode = root;
+    while (curNode != nullptr || !pending.empty()) {
+        if (curNode != nullptr) {
+            pending.push_back(curNode);
+            curNode = curNode->left;
+        }
+        else {
+            curNode = pending.back();
+            pending.pop_back();
+            nodes.push_back(curNode);
+            curNode = curNode->right;
+        }
+    }
+    return nodes;
+}
+
+// Replaces the tree with nodes, which are in key order, in a balanced shape.
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+void BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::relinkNodes(std::vector<Node*>& nodes) {
+    threadNodes(nodes.data(), nodes.size());
+    _root = link(nodes.data(), nodes.size(), nullptr);
+    updateBounds();
+    _size = nodes.size();
+}
+
+// unionWith, or merge when source is other: adds the elements of other whose
+// keys are missing here in one pass over both trees. merge moves the nodes
+// when the allocators compare equal and otherwise copies them and frees the
+// originals; source keeps the rest.
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+void BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::unionLinear(const BinarySearchTree& other, BinarySearchTree* source) {
+    std::vector<Node*> nodes = collectNodes(_root);
+    std::vector<Node*> otherNodes = collectNodes(other._root);
+    bool moveNodes = source != nullptr && _allocator == other._allocator;
+    std::vector<Node*> merged;
+    std::vector<Node*> leftover;
+    std::vector<Node*> copies;
+    std::vector<Node*> copied;
+    merged.reserve(nodes.size() + otherNodes.size());
+    leftover.reserve(otherNodes.size());
+    copies.reserve(otherNodes.size());
+    copied.reserve(otherNodes.size());
+    std::size_t next = 0;
+    try {
+        for (Node* node : otherNodes) {
+            const Key& key = node->keyValuePair.first;
+            while (next < nodes.size() && _compare(nodes[next]->keyValuePair.first, key)) {
+                merged.push_back(nodes[next++]);
+            }
+            if (next < nodes.size() && !_compare(key, nodes[next]->keyValuePair.first)) {
+                leftover.push_back(node);
+            }
+            else if (moveNodes) {
+                merged.push_back(node);
+            }
+            else {
+                copies.push_back(createNode(node->keyValuePair));
+                copied.push_back(node);
+                merged.push_back(copies.back());
+            }
+        }
+    }
+    catch (...) {
+        for (Node* copy : copies) {
+            destroyNode(copy);
+        }
+        throw;
+    }
+    merged.insert(merged.end(), nodes.begin() + next, nodes.end());
+    relinkNodes(merged);
+    if (source != nullptr) {
+        for (Node* node : copied) {
+            source->destroyNode(node);
+        }
+        source->relinkNodes(leftover);
+    }
+}
+
+// intersect (keepShared) or difference in one pass over both trees.
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+void BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::filterLinear(const BinarySearchTree& other, bool keepShared) {
+    std::vector<Node*> nodes = collectNodes(_root);
+    std::vector<Node*> otherNodes = collectNodes(other._root);
+    std::vector<Node*> kept;
+    kept.reserve(nodes.size());
+    std::vector<Node*> dropped;
+    dropped.reserve(nodes.size());
+    std::size_t next = 0;
+    for (Node* node : nodes) {
+        const Key& key = node->keyValuePair.first;
+        while (next < otherNodes.size() && _compare(otherNodes[next]->keyValuePair.first, key)) {
+            next++;
+        }
+        bool shared = next < otherNodes.size() && !_compare(key, otherNodes[next]->keyValuePair.first);
+        (shared == keepShared ? kept : dropped).push_back(node);
+    }
+    relinkNodes(kept);
+    for (Node* node : dropped) {
+        destroyNode(node);
+    }
+}
+
+// split into an emptied right. If copying to right throws, this tree is
+// unchanged.
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+void BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::splitLinear(const Key& key, BinarySearchTree& right) {
+    std::vector<Node*> nodes = collectNodes(_root);
+    auto middle = std::partition_point(nodes.begin(), nodes.end(), [this, &key](const Node* node) {
+        return _compare(node->keyValuePair.first, key);
+    });
+    std::vector<Node*> rightNodes(middle, nodes.end());
+    if (!(_allocator == right._allocator)) {
+        std::vector<Node*> copies = right.copyNodes(rightNodes);
+        for (Node* node : rightNodes) {
+            destroyNode(node);
+        }
+        rightNodes.swap(copies);
+    }
+    nodes.erase(middle, nodes.end());
+    relinkNodes(nodes);
+    right.relinkNodes(rightNodes);
+}
+
+// join after the overlap check. If copying from right throws, both trees
+// are unchanged.
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+void BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::joinLinear(BinarySearchTree& right) {
+    std::vector<Node*> nodes = collectNodes(_root);
+    std::vector<Node*> rightNodes = collectNodes(right._root);
+    nodes.reserve(nodes.size() + rightNodes.size());
+    if (!(_allocator == right._allocator)) {
+        rightNodes = copyNodes(rightNodes);
+        right.clear();
+    }
+    nodes.insert(nodes.end(), rightNodes.begin(), rightNodes.end());
+    relinkNodes(nodes);
+    right._root = nullptr;
+    right._min = nullptr;
+    right._max = nullptr;
+    right._size = 0;
+}
+
+// Unlinked copies of nodes made with this tree's allocator; if copying
+// throws, the copies made so far are freed.
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+std::vector<typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Node*> BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::copyNodes(const std::vector<Node*>& nodes) {
+    std::vector<Node*> copies;
+    copies.reserve(nodes.size());
+    try {
+        for (const Node* node : nodes) {
+            copies.push_back(createNode(node->keyValuePair));
+        }
+    }
+    catch (...) {
+        for (Node* copy : copies) {
+            destroyNode(copy);
+        }
+        throw;
+    }
+    return copies;
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+void BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::unionWith(const BinarySearchTree& other) {
+    if (this == &other || other._root == nullptr) {
+        return;
+    }
+    if constexpr (!Balance::isBalanced) {
+        unionLinear(other, nullptr);
+        return;
+    }
+    Node* copy = nullptr;
+    Node* spare = nullptr;
+    try {
+        cloneNodes(other._root, spare, copy);
+    }
+    catch (...) {
+        destroyNodes(copy);
+        throw;
+    }
+    std::pair<Node*, Node*> merged = unionNodes(_root, copy, workerCount());
+    _size += other._size - destroyNodes(merged.second);
+    _root = merged.first;
+    closeThreads(_root);
+    updateBounds();
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+void BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::merge(BinarySearchTree& other) {
+    if (this == &other || other._root == nullptr) {
+        return;
+    }
+    CursorParking parking(other);
+    if constexpr (!Balance::isBalanced) {
+        unionLinear(other, &other);
+        return;
+    }
+    if (!(_allocator == other._allocator)) {
+        // Nodes cannot change allocators, so the elements are copied over and
+        // the ones that stay behind are copied back.
+        Node* copy = nullptr;
+        Node* spare = nullptr;
+        try {
+            cloneNodes(other._root, spare, copy);
+        }
+        catch (...) {
+            destroyNodes(copy);
+            throw;
+        }
+        std::pair<Node*, Node*> merged = unionNodes(_root, copy, workerCount());
+        std::size_t leftover = countNodes(merged.second);
+        _size += other._size - leftover;
+        _root = merged.first;
+        closeThreads(_root);
+        updateBounds();
+        other.clear();
+        try {
+            other.copyFrom(merged.second, leftover, nullptr);
+        }
+        catch (...) {
+            destroyNodes(merged.second);
+            throw;
+        }
+        destroyNodes(merged.second);
+        return;
+    }
+    std::pair<Node*, Node*> merged = unionNodes(_root, other._root, workerCount());
+    std::size_t leftover = countNodes(merged.second);
+    _size += other._size - leftover;
+    _root = merged.first;
+    closeThreads(_root);
+    updateBounds();
+    other._root = merged.second;
+    closeThreads(other._root);
+    other.updateBounds();
+    other._size = leftover;
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+void BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::intersect(const BinarySearchTree& other) {
+    if (this == &other) {
+        return;
+    }
+    CursorParking parking(*this);
+    if constexpr (!Balance::isBalanced) {
+        filterLinear(other, true);
+        return;
+    }
+    std::pair<Node*, Node*> filtered = filterNodes(_root, other._root, true, workerCount());
+    _root = filtered.first;
+    closeThreads(_root);
+    updateBounds();
+    _size -= destroyNodes(filtered.second);
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+void BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::difference(const BinarySearchTree& other) {
+    CursorParking parking(*this);
+    if (this == &other) {
+        clear();
+        return;
+    }
+    if constexpr (!Balance::isBalanced) {
+        filterLinear(other, false);
+        return;
+    }
+    std::pair<Node*, Node*> filtered = filterNodes(_root, other._root, false, workerCount());
+    _root = filtered.first;
+    closeThreads(_root);
+    updateBounds();
+    _size -= destroyNodes(filtered.second);
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+void BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::split(const Key& key, BinarySearchTree& right) {
+    if (this == &right) {
+        return;
+    }
+    CursorParking parking(*this);
+    CursorParking rightParking(right);
+    right.clear();
+    if constexpr (!Balance::isBalanced) {
+        splitLinear(key, right);
+        return;
+    }
+    std::pair<Node*, Node*> parts = splitNodes(_root, key, false);
+    std::size_t size = leftSize(parts.first, parts.second, _size);
+    if (!(_allocator == right._allocator)) {
+        try {
+            right.copyFrom(parts.second, _size - size, nullptr);
+        }
+        catch (...) {
+            _root = joinNodes(parts.first, parts.second);
+            closeThreads(_root);
+            updateBounds();
+            throw;
+        }
+        destroyNodes(parts.second);
+    }
+    else {
+        right._root = parts.second;
+        right._size = _size - size;
+        closeThreads(right._root);
+        right.updateBounds();
+    }
+    _root = parts.first;
+    closeThreads(_root);
+    updateBounds();
+    _size = size;
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+void BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::join(BinarySearchTree& right) {
+    if (this == &right || right._root == nullptr) {
+        return;
+    }
+    if (_max != nullptr && _compare(right._min->keyValuePair.first, _max->keyValuePair.first)) {
+        throw std::invalid_argument("Trees overlap!");
+    }
+    CursorParking rightParking(right);
+    if constexpr (!Balance::isBalanced) {
+        joinLinear(right);
+        return;
+    }
+    Node* rightRoot = right._root;
+    std::size_t rightSize = right._size;
+    if (!(_allocator == right._allocator)) {
+        Node* spare = nullptr;
+        rightRoot = nullptr;
+        try {
+            cloneNodes(right._root, spare, rightRoot);
+        }
+        catch (...) {
+            destroyNodes(rightRoot);
+            throw;
+        }
+        right.clear();
+    }
+    _root = joinNodes(_root, rightRoot);
+    closeThreads(_root);
+    updateBounds();
+    _size += rightSize;
+    right._root = nullptr;
+    right._min = nullptr;
+    right._max = nullptr;
+    right._size = 0;
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+FrozenTree<Key, Value, Compare> BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::freeze() const {
+    return FrozenTree<Key, Value, Compare>(cbegin(), cend(), _compare);
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+void BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::save(std::ostream& out) const {
+    using Layout = SerializedLayout<Key, Value>;
+    SerializedHeader header = Layout::header(_size);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    Layout::writePadding(out, sizeof(header), Layout::keysOffset());
+    for (ConstIterator iter = cbegin(); iter != cend(); ++iter) {
+        out.write(reinterpret_cast<const char*>(&iter->first), sizeof(Key));
+    }
+    Layout::writePadding(out, Layout::keysOffset() + _size * sizeof(Key), Layout::valuesOffset(_size));
+    for (ConstIterator iter = cbegin(); iter != cend(); ++iter) {
+        out.write(reinterpret_cast<const char*>(&iter->second), sizeof(Value));
+    }
+    if (!out) {
+        throw std::runtime_error("Failed to write tree!");
+    }
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+void BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::load(std::istream& in) {
+    using Layout = SerializedLayout<Key, Value>;
+    SerializedHeader header;
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+        throw std::runtime_error("Failed to read tree!");
+    }
+    Layout::check(header);
+    Layout::checkCount(header.count);
+    std::size_t count = header.count;
+    std::vector<Key> keys;
+    std::vector<Value> values;
+    Layout::skipPadding(in, sizeof(header), Layout::keysOffset());
+    Layout::readArray(in, keys, count);
+    Layout::skipPadding(in, Layout::keysOffset() + count * sizeof(Key), Layout::valuesOffset(count));
+    Layout::readArray(in, values, count);
+    std::vector<std::pair<Key, Value>> keyValuePairs;
+    keyValuePairs.reserve(count);
+    for (std::size_t i = 0; i < count; i++) {
+        keyValuePairs.emplace_back(keys[i], values[i]);
+    }
+    assign(keyValuePairs.begin(), keyValuePairs.end());
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator
+        BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::insert(const Key& key, const Value& value) {
+    OperationScope<Stats> scope(*this, TreeOperation::Insert);
+    return insertNode(createNode(key, value));
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator
+        BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::insert(Key&& key, Value&& value) {
+    OperationScope<Stats> scope(*this, TreeOperation::Insert);
+    return insertNode(createNode(std::move(key), std::move(value)));
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator
+        BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::insert(ConstIterator hint, const Key& key, const Value& value) {
+    OperationScope<Stats> scope(*this, TreeOperation::Insert);
+    return insertNode(createNode(key, value), const_cast<Node*>(hint._node));
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator
+        BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::insert(ConstIterator hint, Key&& key, Value&& value) {
+    OperationScope<Stats> scope(*this, TreeOperation::Insert);
+    return insertNode(createNode(std::move(key), std::move(value)), const_cast<Node*>(hint._node));
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+template<typename... Args>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator
+        BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::emplace(Args&&... args) {
+    OperationScope<Stats> scope(*this, TreeOperation::Insert);
+    return insertNode(createNode(std::forward<Args>(args)...));
+}
+
+// Inserts only when the key is absent; the value is constructed in place and
+// arguments are not consumed if an element with the key already exists.
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator, bool>
+        BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::tryEmplace(const Key& key, Args&&... args) {
+    OperationScope<Stats> scope(*this, TreeOperation::Insert);
+    Node* bound = lowerBoundNode(key);
+    if (bound != nullptr && !_compare(key, bound->keyValuePair.first)) {
+        return std::make_pair(Iterator(bound), false);
+    }
+    Node* node = createNode(std::piecewise_construct, std::forward_as_tuple(key),
+                            std::forward_as_tuple(std::forward<Args>(args)...));
+    return std::make_pair(insertNode(node), true);
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator, bool>
+        BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::tryEmplace(Key&& key, Args&&... args) {
+    OperationScope<Stats> scope(*this, TreeOperation::Insert);
+    Node* bound = lowerBoundNode(key);
+    if (bound != nullptr && !_compare(key, bound->keyValuePair.first)) {
+        return std::make_pair(Iterator(bound), false);
+    }
+    Node* node = createNode(std::piecewise_construct, std::forward_as_tuple(std::move(key)),
+                            std::forward_as_tuple(std::forward<Args>(args)...));
+    return std::make_pair(insertNode(node), true);
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator, bool>
+        BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::tryEmplace(ConstIterator hint, const Key& key, Args&&... args) {
+    OperationScope<Stats> scope(*this, TreeOperation::Insert);
+    Node* next = const_cast<Node*>(hint._node);
+    Node* previous = previousNode(next);
+    if (next != nullptr && !_compare(key, next->keyValuePair.first) && !_compare(next->keyValuePair.first, key)) {
+        return std::make_pair(Iterator(next), false);
+    }
+    if (previous != nullptr && !_compare(key, previous->keyValuePair.first) && !_compare(previous->keyValuePair.first, key)) {
+        return std::make_pair(Iterator(previous), false);
+    }
+    bool fits = (next == nullptr || _compare(key, next->keyValuePair.first)) &&
+                (previous == nullptr || _compare(previous->keyValuePair.first, key));
+    if (!fits) {
+        Node* bound = lowerBoundNode(key);
+        if (bound != nullptr && !_compare(key, bound->keyValuePair.first)) {
+            return std::make_pair(Iterator(bound), false);
+        }
+    }
+    Node* node = createNode(std::piecewise_construct, std::forward_as_tuple(key),
+                            std::forward_as_tuple(std::forward<Args>(args)...));
+    if (!fits) {
+        return std::make_pair(insertNode(node), true);
+    }
+    if (next != nullptr && next->left == nullptr) {
+        return std::make_pair(attachNode(node, next, true), true);
+    }
+    return std::make_pair(attachNode(node, previous, false), true);
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+template<typename K>
+std::size_t BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::eraseEqual(const K& key) {
+    Node* first = lowerBoundNode(key);
+    if (first == nullptr || _compare(key, first->keyValuePair.first)) {
+        return 0;
+    }
+    if constexpr (Balance::isBalanced) {
+        Iterator second(first);
+        ++second;
+        if (second != end() && !_compare(key, second->first)) {
+            Node* bound = upperBoundNode(key);
+            for (Cursor* cursor = _cursors; cursor != nullptr; cursor = cursor->_nextCursor) {
+                if (cursor->_next != nullptr && !_compare(key, cursor->_next->keyValuePair.first)
+                        && !_compare(cursor->_next->keyValuePair.first, key)) {
+                    cursor->_next = bound;
+                }
+            }
+            std::pair<Node*, Node*> less = splitNodes(_root, key, false);
+            std::pair<Node*, Node*> equal = splitNodes(less.second, key, true);
+            _root = joinNodes(less.first, equal.second);
+            closeThreads(_root);
+            updateBounds();
+            std::size_t erased = destroyNodes(equal.first);
+            _size -= erased;
+            return erased;
+        }
+    }
+    std::size_t erased = 0;
+    Iterator iter(first);
+    while (iter != end() && !_compare(key, iter->first)) {
+        Node* node = iter._node;
+        ++iter;
+        remove(node);
+        erased++;
+    }
+    return erased;
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+std::size_t BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::erase(const Key& key) {
+    OperationScope<Stats> scope(*this, TreeOperation::Erase);
+    std::size_t erased = eraseEqual(key);
+    if constexpr (Stats::enabled) {
+        Stats::recordDuplicateErasures(erased > 1 ? erased - 1 : 0);
+    }
+    return erased;
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator
+        BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::erase(Iterator position) {
+    OperationScope<Stats> scope(*this, TreeOperation::Erase);
+    Iterator next = position;
+    ++next;
+    remove(position._node);
+    return next;
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator
+        BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::erase(Iterator first, Iterator last) {
+    OperationScope<Stats> scope(*this, TreeOperation::Erase);
+    while (first != last) {
+        Node* node = first._node;
+        ++first;
+        remove(node);
+    }
+    return last;
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ConstIterator BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::find(const Key& key) const {
+    OperationScope<Stats> scope(*this, TreeOperation::Find);
+    return ConstIterator(findNode(key));
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::find(const Key& key) {
+    OperationScope<Stats> scope(*this, TreeOperation::Find);
+    return Iterator(findNode(key));
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+void BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::findBatch(const std::vector<Key>& keys, std::vector<ConstIterator>& out) const {
+    OperationScope<Stats> scope(*this, TreeOperation::Find);
+    out.assign(keys.size(), cend());
+    parallelFor(keys.size(), [this, &keys, &out](std::size_t begin, std::size_t end) {
+        findInterleaved(keys.data() + begin, end - begin, out.data() + begin);
+    });
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+void BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::findBatch(const std::vector<Key>& keys, std::vector<Iterator>& out) {
+    OperationScope<Stats> scope(*this, TreeOperation::Find);
+    out.assign(keys.size(), end());
+    parallelFor(keys.size(), [this, &keys, &out](std::size_t begin, std::size_t end) {
+        findInterleaved(keys.data() + begin, end - begin, out.data() + begin);
+    });
+}
+
+// Keeps up to lanes descents in flight and advances them round-robin, so the
+// prefetch issued for one lane's next node overlaps with the other lanes' work.
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+template<typename ResultIterator>
+void BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::findInterleaved(const Key* keys, std::size_t count, ResultIterator* out) const {
+    constexpr std::size_t lanes = 16;
+    Node* cursors[lanes];
+    std::size_t indices[lanes];
+    std::size_t active = 0;
+    std::size_t next = 0;
+    while (active < lanes && next < count) {
+        cursors[active] = _root;
+        indices[active++] = next++;
+    }
+    while (active > 0) {
+        for (std::size_t lane = 0; lane < active;) {
+            Node* curNode = cursors[lane];
+            const Key& key = keys[indices[lane]];
+            bool goLeft = curNode != nullptr && _compare(key, curNode->keyValuePair.first);
+            if (curNode == nullptr || (!goLeft && !_compare(curNode->keyValuePair.first, key))) {
+                out[indices[lane]] = ResultIterator(curNode);
+                if (next < count) {
+                    cursors[lane] = _root;
+                    indices[lane++] = next++;
+                }
+                else {
+                    active--;
+                    cursors[lane] = cursors[active];
+                    indices[lane] = indices[active];
+                }
+                continue;
+            }
+            curNode = goLeft ? curNode->left : curNode->right;
+            __builtin_prefetch(curNode);
+            cursors[lane++] = curNode;
+        }
+    }
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+void BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::insertBatch(std::vector<std::pair<Key, Value>> keyValuePairs) {
+    OperationScope<Stats> scope(*this, TreeOperation::Insert);
+    std::size_t logSize = 1;
+    while ((std::size_t(1) << logSize) < _size) {
+        logSize++;
+    }
+    if (keyValuePairs.size() * logSize < _size) {
+        for (auto& keyValuePair : keyValuePairs) {
+            insertNode(createNode(std::move(keyValuePair)));
+        }
+        return;
+    }
+    auto keyLess = [this](const std::pair<Key, Value>& left, const std::pair<Key, Value>& right) {
+        return _compare(left.first, right.first);
+    };
+    if (!std::is_sorted(keyValuePairs.begin(), keyValuePairs.end(), keyLess)) {
+        parallelStableSort(keyValuePairs.begin(), keyValuePairs.end(), keyLess);
+    }
+    // insert puts each element before the equal ones already there, so a
+    // run of equal keys in the batch ends up in reverse input order.
+    for (auto first = keyValuePairs.begin(); first != keyValuePairs.end();) {
+        auto last = std::find_if(first + 1, keyValuePairs.end(), [&](const std::pair<Key, Value>& keyValuePair) {
+            return keyLess(*first, keyValuePair);
+        });
+        std::reverse(first, last);
+        first = last;
+    }
+    std::vector<Node*> nodes;
+    nodes.reserve(_size + keyValuePairs.size());
+    std::vector<Node*> created;
+    created.reserve(keyValuePairs.size());
+    try {
+        if constexpr (HasReserve<NodeAllocator>::value) {
+            _allocator.reserve(keyValuePairs.size());
+        }
+        for (auto& keyValuePair : keyValuePairs) {
+            created.push_back(createNode(std::move(keyValuePair)));
+        }
+    }
+    catch (...) {
+        for (Node* node : created) {
+            destroyNode(node);
+        }
+        throw;
+    }
+    // New elements go before existing ones with an equal key, as insert does.
+    auto newNode = created.begin();
+    for (Iterator iter = begin(); iter != end(); ++iter) {
+        while (newNode != created.end() && !_compare(iter->first, (*newNode)->keyValuePair.first)) {
+            nodes.push_back(*newNode++);
+        }
+        nodes.push_back(iter._node);
+    }
+    nodes.insert(nodes.end(), newNode, created.end());
+    threadNodes(nodes.data(), nodes.size());
+    _root = link(nodes.data(), nodes.size(), nullptr);
+    updateBounds();
+    _size = nodes.size();
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator
+        BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::lowerBound(const Key& key) {
+    OperationScope<Stats> scope(*this, TreeOperation::Bound);
+    return Iterator(lowerBoundNode(key));
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ConstIterator
+        BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::lowerBound(const Key& key) const {
+    OperationScope<Stats> scope(*this, TreeOperation::Bound);
+    return ConstIterator(lowerBoundNode(key));
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator
+        BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::upperBound(const Key& key) {
+    OperationScope<Stats> scope(*this, TreeOperation::Bound);
+    return Iterator(upperBoundNode(key));
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ConstIterator
+        BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::upperBound(const Key& key) const {
+    OperationScope<Stats> scope(*this, TreeOperation::Bound);
+    return ConstIterator(upperBoundNode(key));
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+std::pair<typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator, typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator>
+        BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::equalRange(const Key& key) {
+    return std::make_pair(lowerBound(key), upperBound(key));
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+std::pair<typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ConstIterator, typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ConstIterator>
+        BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::equalRange(const Key& key) const {
+    return std::make_pair(lowerBound(key), upperBound(key));
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+bool BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::contains(const Key& key) const {
+    return find(key) != cend();
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+template<typename K, typename C, typename>
+std::size_t BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::erase(const K& key) {
+    OperationScope<Stats> scope(*this, TreeOperation::Erase);
+    std::size_t erased = eraseEqual(key);
+    if constexpr (Stats::enabled) {
+        Stats::recordDuplicateErasures(erased > 1 ? erased - 1 : 0);
+    }
+    return erased;
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ConstIterator
+        BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::find(const K& key) const {
+    OperationScope<Stats> scope(*this, TreeOperation::Find);
+    return ConstIterator(findNode(key));
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator
+        BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::find(const K& key) {
+    OperationScope<Stats> scope(*this, TreeOperation::Find);
+    return Iterator(findNode(key));
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+template<typename K, typename C, typename>
+bool BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::contains(const K& key) const {
+    return find(key) != cend();
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator
+        BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::lowerBound(const K& key) {
+    OperationScope<Stats> scope(*this, TreeOperation::Bound);
+    return Iterator(lowerBoundNode(key));
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ConstIterator
+        BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::lowerBound(const K& key) const {
+    OperationScope<Stats> scope(*this, TreeOperation::Bound);
+    return ConstIterator(lowerBoundNode(key));
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator
+        BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::upperBound(const K& key) {
+    OperationScope<Stats> scope(*this, TreeOperation::Bound);
+    return Iterator(upperBoundNode(key));
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ConstIterator
+        BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::upperBound(const K& key) const {
+    OperationScope<Stats> scope(*this, TreeOperation::Bound);
+    return ConstIterator(upperBoundNode(key));
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+template<typename K, typename C, typename>
+std::pair<typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator, typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator>
+        BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::equalRange(const K& key) {
+    return std::make_pair(lowerBound(key), upperBound(key));
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+template<typename K, typename C, typename>
+std::pair<typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ConstIterator, typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ConstIterator>
+        BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::equalRange(const K& key) const {
+    return std::make_pair(lowerBound(key), upperBound(key));
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+const Compare& BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::keyCompare() const {
+    return _compare;
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ConstIterator BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::min(const Key& key) const {
+    std::pair<ConstIterator, ConstIterator> keyValues = equalRange(key);
+    if (keyValues.first == keyValues.second) {
+        return cend();
+    }
+    ConstIterator minPairIterator = ConstIterator(keyValues.first);
+    for (ConstIterator iterator = keyValues.first; iterator != keyValues.second; ++iterator) {
+        if (iterator->second < minPairIterator->second) {
+            minPairIterator = iterator;
+        }
+    }
+    return minPairIterator;
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ConstIterator BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::max(const Key& key) const {
+    std::pair<ConstIterator, ConstIterator> keyValues = equalRange(key);
+    if (keyValues.first == keyValues.second) {
+        return cend();
+    }
+    ConstIterator maxPairIterator = ConstIterator(keyValues.first);
+    for (ConstIterator iterator = keyValues.first; iterator != keyValues.second; ++iterator) {
+        if (iterator->second > maxPairIterator->second) {
+            maxPairIterator = iterator;
+        }
+    }
+    return maxPairIterator;
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::begin() {
+    return BinarySearchTree::Iterator(_min);
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::end() {
+    return BinarySearchTree::Iterator(nullptr);
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ConstIterator BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::cbegin() const {
+    return BinarySearchTree::ConstIterator(_min);
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ConstIterator BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::cend() const {
+    return BinarySearchTree::ConstIterator(nullptr);
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ReverseIterator BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::rbegin() {
+    return ReverseIterator(Iterator(_max));
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ReverseIterator BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::rend() {
+    return ReverseIterator(end());
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ConstReverseIterator BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::crbegin() const {
+    return ConstReverseIterator(ConstIterator(_max));
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ConstReverseIterator BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::crend() const {
+    return ConstReverseIterator(cend());
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+template<typename BaseIterator>
+BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ReverseIteratorAdaptor<BaseIterator>::ReverseIteratorAdaptor(BaseIterator iterator): _iterator(iterator) {
+}
+
+// Dereferences a copy so that the non-const Iterator overloads are used.
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+template<typename BaseIterator>
+decltype(auto) BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ReverseIteratorAdaptor<BaseIterator>::operator*() const {
+    BaseIterator iterator = _iterator;
+    return *iterator;
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+template<typename BaseIterator>
+decltype(auto) BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ReverseIteratorAdaptor<BaseIterator>::operator->() const {
+    BaseIterator iterator = _iterator;
+    return iterator.operator->();
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+template<typename BaseIterator>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::template ReverseIteratorAdaptor<BaseIterator> BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ReverseIteratorAdaptor<BaseIterator>::operator++() {
+    --_iterator;
+    return *this;
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+template<typename BaseIterator>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::template ReverseIteratorAdaptor<BaseIterator> BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ReverseIteratorAdaptor<BaseIterator>::operator++(int) {
+    ReverseIteratorAdaptor previous = *this;
+    --_iterator;
+    return previous;
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+template<typename BaseIterator>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::template ReverseIteratorAdaptor<BaseIterator> BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ReverseIteratorAdaptor<BaseIterator>::operator--() {
+    ++_iterator;
+    return *this;
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+template<typename BaseIterator>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::template ReverseIteratorAdaptor<BaseIterator> BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ReverseIteratorAdaptor<BaseIterator>::operator--(int) {
+    ReverseIteratorAdaptor previous = *this;
+    ++_iterator;
+    return previous;
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+template<typename BaseIterator>
+bool BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ReverseIteratorAdaptor<BaseIterator>::operator==(const ReverseIteratorAdaptor& other) const {
+    return _iterator == other._iterator;
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+template<typename BaseIterator>
+bool BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ReverseIteratorAdaptor<BaseIterator>::operator!=(const ReverseIteratorAdaptor& other) const {
+    return _iterator != other._iterator;
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+template<typename BaseIterator>
+BaseIterator BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ReverseIteratorAdaptor<BaseIterator>::base() const {
+    return _iterator;
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+const Stats& BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::stats() const {
+    return *this;
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+std::size_t BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::size() const {
+    return _size;
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+std::size_t BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::height() const {
+    return height(_root);
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+std::size_t BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::rank(const Key& key) const {
+    static_assert(OrderStatistics, "rank requires OrderStatistics");
+    std::size_t index = 0;
+    Node* curNode = _root;
+    while (curNode != nullptr) {
+        if (_compare(curNode->keyValuePair.first, key)) {
+            index += subtreeSize(curNode->left) + 1;
+            curNode = curNode->right;
+        }
+        else {
+            curNode = curNode->left;
+        }
+    }
+    return index;
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Iterator BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::select(std::size_t index) {
+    static_assert(OrderStatistics, "select requires OrderStatistics");
+    return Iterator(selectNode(_root, index));
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::ConstIterator BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::select(std::size_t index) const {
+    static_assert(OrderStatistics, "select requires OrderStatistics");
+    return ConstIterator(selectNode(static_cast<const Node*>(_root), index));
+}
+
+// Number of elements with keys in [low, high).
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+std::size_t BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::countRange(const Key& low, const Key& high) const {
+    std::size_t lowRank = rank(low);
+    std::size_t highRank = rank(high);
+    return highRank > lowRank ? highRank - lowRank : 0;
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename Aggregate::Type BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::aggregate(const Key& low, const Key& high) const {
+    static_assert(Aggregate::enabled, "aggregate requires an Aggregate policy");
+    return aggregateNodes(_root, low, high, false);
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename Aggregate::Type BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::aggregate(const Key& key) const {
+    static_assert(Aggregate::enabled, "aggregate requires an Aggregate policy");
+    return aggregateNodes(_root, key, key, true);
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename Aggregate::Type BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::aggregate() const {
+    static_assert(Aggregate::enabled, "aggregate requires an Aggregate policy");
+    return subtreeAggregate(_root);
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+void BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::setValue(Iterator position, Value value) {
+    position._node->keyValuePair.second = std::move(value);
+    for (Node* node = position._node; node != nullptr; node = node->parent) {
+        update(node);
+    }
+}
+
+// Descends to the first node inside the range; past it, the range covers a
+// suffix of that node's left subtree and a prefix of its right subtree. Each
+// is gathered along one path, taking whole subtrees that lie inside.
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename Aggregate::Type BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::aggregateNodes(const BinarySearchTree::Node* node, const Key& low,
+                                                                                const Key& high, bool inclusive) const {
+    auto belowHigh = [&](const Key& key) {
+        return inclusive ? !_compare(high, key) : _compare(key, high);
+    };
+    while (node != nullptr && (_compare(node->keyValuePair.first, low) || !belowHigh(node->keyValuePair.first))) {
+        node = _compare(node->keyValuePair.first, low) ? node->right : node->left;
+    }
+    if (node == nullptr) {
+        return Aggregate::identity();
+    }
+    typename Aggregate::Type left = Aggregate::identity();
+    for (const Node* curNode = node->left; curNode != nullptr;) {
+        if (!_compare(curNode->keyValuePair.first, low)) {
+            left = Aggregate::combine(Aggregate::combine(Aggregate::lift(curNode->keyValuePair.second),
+                                                         subtreeAggregate(curNode->right)), left);
+            curNode = curNode->left;
+        }
+        else {
+            curNode = curNode->right;
+        }
+    }
+    typename Aggregate::Type right = Aggregate::identity();
+    for (const Node* curNode = node->right; curNode != nullptr;) {
+        if (belowHigh(curNode->keyValuePair.first)) {
+            right = Aggregate::combine(right, Aggregate::combine(subtreeAggregate(curNode->left),
+                                                                 Aggregate::lift(curNode->keyValuePair.second)));
+            curNode = curNode->right;
+        }
+        else {
+            curNode = curNode->left;
+        }
+    }
+    return Aggregate::combine(Aggregate::combine(left, Aggregate::lift(node->keyValuePair.second)), right);
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Node* BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::minNode(BinarySearchTree::Node* node) {
+    auto сurNode = node;
+    while (сurNode->left != nullptr) {
+        сurNode = сurNode->left;
+    }
+    return сurNode;
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Node* BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::maxNode(BinarySearchTree::Node* node) {
+    auto сurNode = node;
+    while (сurNode->right != nullptr) {
+        сurNode = сurNode->right;
+    }
+    return сurNode;
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+void BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::updateBounds() {
+    _min = _root != nullptr ? minNode(_root) : nullptr;
+    _max = _root != nullptr ? maxNode(_root) : nullptr;
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+typename BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Node* BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::previousNode(BinarySearchTree::Node* node) const {
+    if (node == nullptr) {
+        return _max;
+    }
+    if (node == _min) {
+        return nullptr;
+    }
+    if constexpr (Threaded) {
+        return node->prev;
+    }
+    else {
+        if (node->left != nullptr) {
+            return maxNode(node->left);
+        }
+        while (node->parent->left == node) {
+            node = node->parent;
+        }
+        return node->parent;
+    }
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+void BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::clear() {
+    bool released = false;
+    if constexpr (std::is_trivially_destructible_v<Node> && HasRelease<NodeAllocator>::value) {
+        released = _allocator.release();
+        if constexpr (Stats::enabled) {
+            if (released) {
+                Stats::recordDeallocations(_size);
+            }
+        }
+    }
+    if (!released) {
+        destroyNodes(_root);
+    }
+    _root = nullptr;
+    _min = nullptr;
+    _max = nullptr;
+    _size = 0;
+}
+
+// Frees every node of the subtree under node and returns how many there were.
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+std::size_t BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::destroyNodes(BinarySearchTree::Node* node) {
+    std::size_t count = 0;
+    if (node != nullptr) {
+        std::queue<Node*> children;
+        children.push(node);
+        while (!children.empty()) {
+            Node* curNode = children.front();
+            if (curNode->left != nullptr) {
+                children.push(curNode->left);
+            }
+            if (curNode->right != nullptr) {
+                children.push(curNode->right);
+            }
+            destroyNode(curNode);
+            children.pop();
+            count++;
+        }
+    }
+    return count;
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+std::size_t BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::countNodes(const BinarySearchTree::Node* node, std::size_t limit) {
+    if constexpr (OrderStatistics) {
+        return std::min(subtreeSize(node), limit);
+    }
+    std::size_t count = 0;
+    std::vector<const Node*> pending;
+    if (node != nullptr) {
+        pending.push_back(node);
+    }
+    while (!pending.empty() && count < limit) {
+        const Node* curNode = pending.back();
+        pending.pop_back();
+        count++;
+        if (curNode->left != nullptr) {
+            pending.push_back(curNode->left);
+        }
+        if (curNode->right != nullptr) {
+            pending.push_back(curNode->right);
+        }
+    }
+    return count;
+}
+
+// Size of left when left and right hold total nodes together. Counts both
+// sides in growing steps, so it costs O(min(|left|, |right|)).
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+std::size_t BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::leftSize(const BinarySearchTree::Node* left, const BinarySearchTree::Node* right,
+                                                   std::size_t total) {
+    for (std::size_t limit = 64;; limit *= 2) {
+        std::size_t count = countNodes(left, limit);
+        if (count < limit) {
+            return count;
+        }
+        count = countNodes(right, limit);
+        if (count < limit) {
+            return total - count;
+        }
+    }
+}
+
+template<typename Key, typename Value, typename Balance, typename Allocator, bool OrderStatistics, typename Stats, typename Compare, bool Threaded, typename Aggregate>
+template<typename... Args>
+BinarySearchTree<Key, Value, Balance, Allocator, OrderStatistics, Stats, Compare, Threaded, Aggregate>::Node::Node(Args&&... args):
+        keyValuePair(std::forward<Args>(args)...) {
+}
@@ -0,0 +1,868 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <numeric>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "Parallel.h"
+
+// Key and value of one CompactTree element. With KeysOnly the key is also
+// the value and nothing else is stored.
+template <typename Key, typename Value, bool KeysOnly>
+struct CompactEntry
+{
+    template<typename K, typename... Args>
+    explicit CompactEntry(K&& key, Args&&... args);
+
+    Key key;
+    Value value;
+};
+
+template <typename Key, typename Value>
+struct CompactEntry<Key, Value, true>
+{
+    template<typename K, typename... Args>
+    explicit CompactEntry(K&& key, Args&&... args);
+
+    Key key;
+};
+
+// Map with unique keys whose nodes live in one contiguous vector and link
+// to each other by 32-bit index. A node is its entry plus two links; a link
+// with threadBit set is not a child but the in-order neighbour, so iterators
+// step without parent links. Balance is kept scapegoat style (a subtree that
+// grows too deep is rebuilt perfectly balanced), which needs no per-node
+// balance data. For Set<int> over CompactSetTree a node is 12 bytes.
+// Erase moves the last node into the freed slot, so it invalidates iterators
+// to the erased element and to the element stored last. Iterators hold slot
+// indices, so inserts leave them valid, but an insert that grows the vector
+// invalidates references and pointers obtained through them. Key and Value
+// must be move assignable.
+template <typename Key, typename Value, typename Compare = std::less<Key>, bool KeysOnly = false>
+class CompactTree
+{
+    static_assert(!KeysOnly || std::is_same_v<Key, Value>, "KeysOnly trees map every key to itself");
+
+    struct Node : CompactEntry<Key, Value, KeysOnly>
+    {
+        // Constrained so that copying from a non-const Node still picks the
+        // copy constructor.
+        template<typename K, typename = std::enable_if_t<!std::is_same_v<std::decay_t<K>, Node>>, typename... Args>
+        explicit Node(K&& key, Args&&... args);
+
+        std::uint32_t left;
+        std::uint32_t right;
+    };
+
+    template <typename Reference>
+    struct ArrowProxy
+    {
+        Reference reference;
+        Reference* operator->();
+    };
+
+    using ValueReference = std::conditional_t<KeysOnly, const Value&, Value&>;
+
+    static constexpr std::uint32_t threadBit = std::uint32_t(1) << 31;
+    static constexpr std::uint32_t none = threadBit - 1;
+    // A subtree may hold at most alpha of its parent's nodes before it is
+    // rebuilt, which keeps the depth under log base 1/alpha of the size + 1.
+    static constexpr double alpha = 2.0 / 3.0;
+    // Enough for that bound with fewer than 2^31 nodes.
+    static constexpr std::size_t maxDepth = 64;
+
+    static std::uint32_t child(std::uint32_t link);
+    static std::uint32_t thread(std::uint32_t index);
+    static std::size_t heightLimit(std::size_t size);
+    static ValueReference valueOf(Node& node);
+    static const Value& valueOf(const Node& node);
+
+    std::uint32_t leftmost(std::uint32_t index) const;
+    std::uint32_t rightmost(std::uint32_t index) const;
+    std::uint32_t successor(std::uint32_t index) const;
+    std::uint32_t predecessor(std::uint32_t index) const;
+    std::uint32_t findIndex(const Key& key) const;
+    std::uint32_t lowerBoundIndex(const Key& key) const;
+    std::uint32_t upperBoundIndex(const Key& key) const;
+    std::size_t countNodes(std::uint32_t index) const;
+
+    void replaceChild(std::uint32_t parent, std::uint32_t oldChild, std::uint32_t newChild);
+    void relocate(std::uint32_t from, std::uint32_t to);
+    void reserveForInsert();
+    std::uint32_t link(const std::uint32_t* order, std::size_t count, std::uint32_t before, std::uint32_t after);
+    std::uint32_t rebuild(std::uint32_t index, std::size_t count);
+
+    template<typename RandomIterator>
+    void build(RandomIterator first, std::size_t count);
+
+    std::vector<Node> _nodes;
+    std::uint32_t _root = none;
+    // Largest size since the last full rebuild.
+    std::size_t _maxSize = 0;
+    Compare _compare;
+
+public:
+    using KeyCompare = Compare;
+
+    CompactTree() = default;
+    explicit CompactTree(const Compare& compare);
+
+    template<typename InputIterator>
+    CompactTree(InputIterator first, InputIterator last);
+
+    CompactTree(const CompactTree& other) = default;
+    CompactTree& operator=(const CompactTree& other) = default;
+
+    CompactTree(CompactTree&& other) noexcept;
+    CompactTree& operator=(CompactTree&& other) noexcept;
+
+    class Iterator
+    {
+    public:
+        Iterator(CompactTree* tree = nullptr, std::uint32_t index = none);
+
+        std::pair<const Key&, ValueReference> operator*() const;
+        ArrowProxy<std::pair<const Key&, ValueReference>> operator->() const;
+
+        Iterator operator++();
+        Iterator operator++(int);
+
+        Iterator operator--();
+        Iterator operator--(int);
+
+        bool operator==(const Iterator& other) const;
+        bool operator!=(const Iterator& other) const;
+
+    private:
+        friend class CompactTree;
+        friend class ConstIterator;
+
+        CompactTree* _tree;
+        std::uint32_t _index;
+    };
+
+    class ConstIterator
+    {
+    public:
+        ConstIterator(const CompactTree* tree = nullptr, std::uint32_t index = none);
+        ConstIterator(const Iterator& other);
+
+        std::pair<const Key&, const Value&> operator*() const;
+        ArrowProxy<std::pair<const Key&, const Value&>> operator->() const;
+
+        ConstIterator operator++();
+        ConstIterator operator++(int);
+
+        ConstIterator operator--();
+        ConstIterator operator--(int);
+
+        bool operator==(const ConstIterator& other) const;
+        bool operator!=(const ConstIterator& other) const;
+
+    private:
+        const CompactTree* _tree;
+        std::uint32_t _index;
+    };
+
+    // Replaces the contents with [first, last); for repeated keys the last
+    // value wins. Sorted input is linked in O(n) with nodes in key order.
+    template<typename InputIterator>
+    void assign(InputIterator first, InputIterator last);
+
+    // Inserts key unless it is present; with KeysOnly args are ignored.
+    template<typename... Args>
+    std::pair<Iterator, bool> tryEmplace(const Key& key, Args&&... args);
+
+    std::size_t erase(const Key& key);
+
+    ConstIterator find(const Key& key) const;
+    Iterator find(const Key& key);
+    bool contains(const Key& key) const;
+
+    Iterator lowerBound(const Key& key);
+    ConstIterator lowerBound(const Key& key) const;
+
+    Iterator upperBound(const Key& key);
+    ConstIterator upperBound(const Key& key) const;
+
+    std::pair<Iterator, Iterator> equalRange(const Key& key);
+    std::pair<ConstIterator, ConstIterator> equalRange(const Key& key) const;
+
+    Iterator begin();
+    Iterator end();
+
+    ConstIterator cbegin() const;
+    ConstIterator cend() const;
+
+    std::size_t size() const;
+    // Bytes held by the node vector, including spare capacity.
+    std::size_t memoryUsage() const;
+    void clear();
+
+    const Compare& keyCompare() const;
+};
+
+// Key-only CompactTree for Set, which stores each value once.
+template <typename Key, typename Compare = std::less<Key>>
+using CompactSetTree = CompactTree<Key, Key, Compare, true>;
+
+template<typename Key, typename Value, bool KeysOnly>
+template<typename K, typename... Args>
+CompactEntry<Key, Value, KeysOnly>::CompactEntry(K&& key, Args&&... args):
+        key(std::forward<K>(key)), value(std::forward<Args>(args)...) {
+}
+
+template<typename Key, typename Value>
+template<typename K, typename... Args>
+CompactEntry<Key, Value, true>::CompactEntry(K&& key, Args&&...): key(std::forward<K>(key)) {
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+template<typename K, typename, typename... Args>
+CompactTree<Key, Value, Compare, KeysOnly>::Node::Node(K&& key, Args&&... args):
+        CompactEntry<Key, Value, KeysOnly>(std::forward<K>(key), std::forward<Args>(args)...),
+        left(thread(none)), right(thread(none)) {
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+template<typename Reference>
+Reference* CompactTree<Key, Value, Compare, KeysOnly>::ArrowProxy<Reference>::operator->() {
+    return &reference;
+}
+
+// The child behind link, or none when link is a thread.
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+std::uint32_t CompactTree<Key, Value, Compare, KeysOnly>::child(std::uint32_t link) {
+    return (link & threadBit) != 0 ? none : link;
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+std::uint32_t CompactTree<Key, Value, Compare, KeysOnly>::thread(std::uint32_t index) {
+    return index | threadBit;
+}
+
+// Deepest a new node may land before a scapegoat is rebuilt.
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+std::size_t CompactTree<Key, Value, Compare, KeysOnly>::heightLimit(std::size_t size) {
+    return static_cast<std::size_t>(std::log(static_cast<double>(size)) / std::log(1 / alpha));
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+typename CompactTree<Key, Value, Compare, KeysOnly>::ValueReference CompactTree<Key, Value, Compare, KeysOnly>::valueOf(Node& node) {
+    if constexpr (KeysOnly) {
+        return node.key;
+    }
+    else {
+        return node.value;
+    }
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+const Value& CompactTree<Key, Value, Compare, KeysOnly>::valueOf(const Node& node) {
+    if constexpr (KeysOnly) {
+        return node.key;
+    }
+    else {
+        return node.value;
+    }
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+std::uint32_t CompactTree<Key, Value, Compare, KeysOnly>::leftmost(std::uint32_t index) const {
+    while (child(_nodes[index].left) != none) {
+        index = _nodes[index].left;
+    }
+    return index;
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+std::uint32_t CompactTree<Key, Value, Compare, KeysOnly>::rightmost(std::uint32_t index) const {
+    while (child(_nodes[index].right) != none) {
+        index = _nodes[index].right;
+    }
+    return index;
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+std::uint32_t CompactTree<Key, Value, Compare, KeysOnly>::successor(std::uint32_t index) const {
+    std::uint32_t right = _nodes[index].right;
+    return (right & threadBit) != 0 ? right & ~threadBit : leftmost(right);
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+std::uint32_t CompactTree<Key, Value, Compare, KeysOnly>::predecessor(std::uint32_t index) const {
+    std::uint32_t left = _nodes[index].left;
+    return (left & threadBit) != 0 ? left & ~threadBit : rightmost(left);
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+std::uint32_t CompactTree<Key, Value, Compare, KeysOnly>::findIndex(const Key& key) const {
+    std::uint32_t index = _root;
+    while (index != none) {
+        const Node& node = _nodes[index];
+        if (_compare(key, node.key)) {
+            index = child(node.left);
+        }
+        else if (_compare(node.key, key)) {
+            index = child(node.right);
+        }
+        else {
+            break;
+        }
+    }
+    return index;
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+std::uint32_t CompactTree<Key, Value, Compare, KeysOnly>::lowerBoundIndex(const Key& key) const {
+    std::uint32_t bound = none;
+    std::uint32_t index = _root;
+    while (index != none) {
+        const Node& node = _nodes[index];
+        if (_compare(node.key, key)) {
+            index = child(node.right);
+        }
+        else {
+            bound = index;
+            index = child(node.left);
+        }
+    }
+    return bound;
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+std::uint32_t CompactTree<Key, Value, Compare, KeysOnly>::upperBoundIndex(const Key& key) const {
+    std::uint32_t bound = none;
+    std::uint32_t index = _root;
+    while (index != none) {
+        const Node& node = _nodes[index];
+        if (_compare(key, node.key)) {
+            bound = index;
+            index = child(node.left);
+        }
+        else {
+            index = child(node.right);
+        }
+    }
+    return bound;
+}
+
+// Size of the subtree under index, walked along the threads.
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+std::size_t CompactTree<Key, Value, Compare, KeysOnly>::countNodes(std::uint32_t index) const {
+    if (index == none) {
+        return 0;
+    }
+    std::uint32_t last = rightmost(index);
+    std::size_t count = 1;
+    for (std::uint32_t current = leftmost(index); current != last; current = successor(current)) {
+        count++;
+    }
+    return count;
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+void CompactTree<Key, Value, Compare, KeysOnly>::replaceChild(std::uint32_t parent, std::uint32_t oldChild,
+                                                              std::uint32_t newChild) {
+    if (parent == none) {
+        _root = newChild;
+    }
+    else if (_nodes[parent].left == oldChild) {
+        _nodes[parent].left = newChild;
+    }
+    else {
+        _nodes[parent].right = newChild;
+    }
+}
+
+// Moves the node at from into the unused slot to, repointing its parent and
+// the two threads that can lead to it.
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+void CompactTree<Key, Value, Compare, KeysOnly>::relocate(std::uint32_t from, std::uint32_t to) {
+    Node& node = _nodes[from];
+    std::uint32_t parent = none;
+    std::uint32_t index = _root;
+    while (index != from) {
+        parent = index;
+        index = _compare(node.key, _nodes[index].key) ? _nodes[index].left : _nodes[index].right;
+    }
+    replaceChild(parent, from, to);
+    if (child(node.left) != none) {
+        _nodes[rightmost(node.left)].right = thread(to);
+    }
+    if (child(node.right) != none) {
+        _nodes[leftmost(node.right)].left = thread(to);
+    }
+    _nodes[to] = std::move(node);
+}
+
+// Grows the vector by a quarter instead of doubling it, so spare capacity
+// stays a small part of the footprint.
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+void CompactTree<Key, Value, Compare, KeysOnly>::reserveForInsert() {
+    if (_nodes.size() >= none) {
+        throw std::length_error("Too many elements!");
+    }
+    if (_nodes.size() == _nodes.capacity()) {
+        _nodes.reserve(std::min<std::size_t>(none, _nodes.capacity() + _nodes.capacity() / 4 + 16));
+    }
+}
+
+// Links the nodes listed in order, which are in key order, into a perfectly
+// balanced subtree. before and after are the neighbours just outside it.
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+std::uint32_t CompactTree<Key, Value, Compare, KeysOnly>::link(const std::uint32_t* order, std::size_t count,
+                                                               std::uint32_t before, std::uint32_t after) {
+    std::size_t middle = count / 2;
+    std::uint32_t index = order[middle];
+    _nodes[index].left = middle > 0 ? link(order, middle, before, index) : thread(before);
+    _nodes[index].right = middle + 1 < count ? link(order + middle + 1, count - middle - 1, index, after) : thread(after);
+    return index;
+}
+
+// Rebalances the subtree under index, which holds count nodes, and returns
+// its new root.
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+std::uint32_t CompactTree<Key, Value, Compare, KeysOnly>::rebuild(std::uint32_t index, std::size_t count) {
+    std::vector<std::uint32_t> order(count);
+    std::uint32_t current = leftmost(index);
+    std::uint32_t before = _nodes[current].left & ~threadBit;
+    for (std::size_t i = 0; i < count; i++) {
+        order[i] = current;
+        current = successor(current);
+    }
+    return link(order.data(), count, before, current);
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+template<typename RandomIterator>
+void CompactTree<Key, Value, Compare, KeysOnly>::build(RandomIterator first, std::size_t count) {
+    if (count >= none) {
+        throw std::length_error("Too many elements!");
+    }
+    clear();
+    _nodes.reserve(count);
+    for (std::size_t i = 0; i < count; i++) {
+        auto&& entry = first[i];
+        _nodes.emplace_back(std::forward<decltype(entry)>(entry).first, std::forward<decltype(entry)>(entry).second);
+    }
+    if (count > 0) {
+        std::vector<std::uint32_t> order(count);
+        std::iota(order.begin(), order.end(), std::uint32_t(0));
+        _root = link(order.data(), count, none, none);
+    }
+    _maxSize = count;
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+CompactTree<Key, Value, Compare, KeysOnly>::CompactTree(const Compare& compare): _compare(compare) {
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+template<typename InputIterator>
+CompactTree<Key, Value, Compare, KeysOnly>::CompactTree(InputIterator first, InputIterator last) {
+    assign(first, last);
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+CompactTree<Key, Value, Compare, KeysOnly>::CompactTree(CompactTree&& other) noexcept:
+        _nodes(std::move(other._nodes)), _root(other._root), _maxSize(other._maxSize), _compare(other._compare) {
+    other.clear();
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+CompactTree<Key, Value, Compare, KeysOnly>& CompactTree<Key, Value, Compare, KeysOnly>::operator=(CompactTree&& other) noexcept {
+    std::swap(_nodes, other._nodes);
+    std::swap(_root, other._root);
+    std::swap(_maxSize, other._maxSize);
+    std::swap(_compare, other._compare);
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+CompactTree<Key, Value, Compare, KeysOnly>::Iterator::Iterator(CompactTree* tree, std::uint32_t index):
+        _tree(tree), _index(index) {
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+std::pair<const Key&, typename CompactTree<Key, Value, Compare, KeysOnly>::ValueReference>
+        CompactTree<Key, Value, Compare, KeysOnly>::Iterator::operator*() const {
+    Node& node = _tree->_nodes[_index];
+    return {node.key, valueOf(node)};
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+typename CompactTree<Key, Value, Compare, KeysOnly>::template ArrowProxy<std::pair<const Key&, typename CompactTree<Key, Value, Compare, KeysOnly>::ValueReference>>
+        CompactTree<Key, Value, Compare, KeysOnly>::Iterator::operator->() const {
+    return {**this};
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+typename CompactTree<Key, Value, Compare, KeysOnly>::Iterator CompactTree<Key, Value, Compare, KeysOnly>::Iterator::operator++() {
+    if (_index != none) {
+        _index = _tree->successor(_index);
+    }
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+typename CompactTree<Key, Value, Compare, KeysOnly>::Iterator CompactTree<Key, Value, Compare, KeysOnly>::Iterator::operator++(int) {
+    Iterator previous = *this;
+    ++(*this);
+    return previous;
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+typename CompactTree<Key, Value, Compare, KeysOnly>::Iterator CompactTree<Key, Value, Compare, KeysOnly>::Iterator::operator--() {
+    if (_index != none) {
+        _index = _tree->predecessor(_index);
+    }
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+typename CompactTree<Key, Value, Compare, KeysOnly>::Iterator CompactTree<Key, Value, Compare, KeysOnly>::Iterator::operator--(int) {
+    Iterator previous = *this;
+    --(*this);
+    return previous;
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+bool CompactTree<Key, Value, Compare, KeysOnly>::Iterator::operator==(const CompactTree::Iterator& other) const {
+    return _index == other._index;
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+bool CompactTree<Key, Value, Compare, KeysOnly>::Iterator::operator!=(const CompactTree::Iterator& other) const {
+    return !(*this == other);
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+CompactTree<Key, Value, Compare, KeysOnly>::ConstIterator::ConstIterator(const CompactTree* tree, std::uint32_t index):
+        _tree(tree), _index(index) {
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+CompactTree<Key, Value, Compare, KeysOnly>::ConstIterator::ConstIterator(const CompactTree::Iterator& other):
+        _tree(other._tree), _index(other._index) {
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+std::pair<const Key&, const Value&> CompactTree<Key, Value, Compare, KeysOnly>::ConstIterator::operator*() const {
+    const Node& node = _tree->_nodes[_index];
+    return {node.key, valueOf(node)};
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+typename CompactTree<Key, Value, Compare, KeysOnly>::template ArrowProxy<std::pair<const Key&, const Value&>>
+        CompactTree<Key, Value, Compare, KeysOnly>::ConstIterator::operator->() const {
+    return {**this};
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+typename CompactTree<Key, Value, Compare, KeysOnly>::ConstIterator CompactTree<Key, Value, Compare, KeysOnly>::ConstIterator::operator++() {
+    if (_index != none) {
+        _index = _tree->successor(_index);
+    }
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+typename CompactTree<Key, Value, Compare, KeysOnly>::ConstIterator CompactTree<Key, Value, Compare, KeysOnly>::ConstIterator::operator++(int) {
+    ConstIterator previous = *this;
+    ++(*this);
+    return previous;
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+typename CompactTree<Key, Value, Compare, KeysOnly>::ConstIterator CompactTree<Key, Value, Compare, KeysOnly>::ConstIterator::operator--() {
+    if (_index != none) {
+        _index = _tree->predecessor(_index);
+    }
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+typename CompactTree<Key, Value, Compare, KeysOnly>::ConstIterator CompactTree<Key, Value, Compare, KeysOnly>::ConstIterator::operator--(int) {
+    ConstIterator previous = *this;
+    --(*this);
+    return previous;
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+bool CompactTree<Key, Value, Compare, KeysOnly>::ConstIterator::operator==(const CompactTree::ConstIterator& other) const {
+    return _index == other._index;
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+bool CompactTree<Key, Value, Compare, KeysOnly>::ConstIterator::operator!=(const CompactTree::ConstIterator& other) const {
+    return !(*this == other);
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+template<typename InputIterator>
+void CompactTree<Key, Value, Compare, KeysOnly>::assign(InputIterator first, InputIterator last) {
+    auto keyLess = [this](const auto& left, const auto& right) {
+        return _compare(left.first, right.first);
+    };
+    auto notLess = [&keyLess](const auto& left, const auto& right) {
+        return !keyLess(left, right);
+    };
+    using Category = typename std::iterator_traits<InputIterator>::iterator_category;
+    if constexpr (std::is_base_of_v<std::random_access_iterator_tag, Category>) {
+        if (std::adjacent_find(first, last, notLess) == last) {
+            build(first, last - first);
+            return;
+        }
+    }
+    std::vector<std::pair<Key, Value>> entries(first, last);
+    if (!std::is_sorted(entries.begin(), entries.end(), keyLess)) {
+        parallelStableSort(entries.begin(), entries.end(), keyLess);
+    }
+    std::size_t unique = 0;
+    for (auto& entry : entries) {
+        if (unique > 0 && !keyLess(entries[unique - 1], entry)) {
+            entries[unique - 1].second = std::move(entry.second);
+        }
+        else {
+            entries[unique++] = std::move(entry);
+        }
+    }
+    build(std::make_move_iterator(entries.begin()), unique);
+}
+
+// Hangs the new node off the search path; if it lands deeper than
+// heightLimit allows, the lowest ancestor holding more than alpha of its
+// subtree on the path side is rebuilt.
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+template<typename... Args>
+std::pair<typename CompactTree<Key, Value, Compare, KeysOnly>::Iterator, bool>
+        CompactTree<Key, Value, Compare, KeysOnly>::tryEmplace(const Key& key, Args&&... args) {
+    std::uint32_t path[maxDepth];
+    std::size_t depth = 0;
+    bool goLeft = false;
+    std::uint32_t index = _root;
+    while (index != none) {
+        const Node& node = _nodes[index];
+        if (_compare(key, node.key)) {
+            goLeft = true;
+        }
+        else if (_compare(node.key, key)) {
+            goLeft = false;
+        }
+        else {
+            return std::make_pair(Iterator(this, index), false);
+        }
+        path[depth++] = index;
+        index = child(goLeft ? node.left : node.right);
+    }
+    reserveForInsert();
+    std::uint32_t added = static_cast<std::uint32_t>(_nodes.size());
+    _nodes.emplace_back(key, std::forward<Args>(args)...);
+    if (depth == 0) {
+        _root = added;
+    }
+    else {
+        std::uint32_t parent = path[depth - 1];
+        if (goLeft) {
+            _nodes[added].left = _nodes[parent].left;
+            _nodes[added].right = thread(parent);
+            _nodes[parent].left = added;
+        }
+        else {
+            _nodes[added].right = _nodes[parent].right;
+            _nodes[added].left = thread(parent);
+            _nodes[parent].right = added;
+        }
+    }
+    _maxSize = std::max(_maxSize, _nodes.size());
+    if (depth > heightLimit(_nodes.size())) {
+        std::uint32_t current = added;
+        std::size_t size = 1;
+        for (std::size_t i = depth; i-- > 0;) {
+            const Node& parent = _nodes[path[i]];
+            std::uint32_t sibling = child(parent.left) == current ? child(parent.right) : child(parent.left);
+            std::size_t parentSize = size + 1 + countNodes(sibling);
+            if (size > alpha * parentSize) {
+                replaceChild(i > 0 ? path[i - 1] : none, path[i], rebuild(path[i], parentSize));
+                break;
+            }
+            current = path[i];
+            size = parentSize;
+        }
+    }
+    return std::make_pair(Iterator(this, added), true);
+}
+
+// Unlinks the node like a plain BST erase (a node with two children is
+// replaced by its successor), moves the last node into its slot and
+// rebuilds the whole tree once it has shrunk below alpha of its peak.
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+std::size_t CompactTree<Key, Value, Compare, KeysOnly>::erase(const Key& key) {
+    std::uint32_t parent = none;
+    std::uint32_t index = _root;
+    while (index != none) {
+        const Node& node = _nodes[index];
+        if (_compare(key, node.key)) {
+            parent = index;
+            index = child(node.left);
+        }
+        else if (_compare(node.key, key)) {
+            parent = index;
+            index = child(node.right);
+        }
+        else {
+            break;
+        }
+    }
+    if (index == none) {
+        return 0;
+    }
+    Node& node = _nodes[index];
+    std::uint32_t left = child(node.left);
+    std::uint32_t right = child(node.right);
+    if (left == none && right == none) {
+        if (parent == none) {
+            _root = none;
+        }
+        else if (_nodes[parent].left == index) {
+            _nodes[parent].left = node.left;
+        }
+        else {
+            _nodes[parent].right = node.right;
+        }
+    }
+    else if (right == none) {
+        _nodes[rightmost(left)].right = node.right;
+        replaceChild(parent, index, left);
+    }
+    else if (left == none) {
+        _nodes[leftmost(right)].left = node.left;
+        replaceChild(parent, index, right);
+    }
+    else {
+        std::uint32_t successorParent = index;
+        std::uint32_t next = right;
+        while (child(_nodes[next].left) != none) {
+            successorParent = next;
+            next = _nodes[next].left;
+        }
+        Node& successorNode = _nodes[next];
+        _nodes[rightmost(left)].right = thread(next);
+        if (successorParent != index) {
+            _nodes[successorParent].left = child(successorNode.right) != none ? successorNode.right : thread(next);
+            successorNode.right = right;
+        }
+        successorNode.left = left;
+        replaceChild(parent, index, next);
+    }
+    std::uint32_t last = static_cast<std::uint32_t>(_nodes.size() - 1);
+    if (index != last) {
+        relocate(last, index);
+    }
+    _nodes.pop_back();
+    if (_nodes.size() < alpha * _maxSize) {
+        if (_root != none) {
+            _root = rebuild(_root, _nodes.size());
+        }
+        _maxSize = _nodes.size();
+    }
+    return 1;
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+typename CompactTree<Key, Value, Compare, KeysOnly>::ConstIterator CompactTree<Key, Value, Compare, KeysOnly>::find(const Key& key) const {
+    return ConstIterator(this, findIndex(key));
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+typename CompactTree<Key, Value, Compare, KeysOnly>::Iterator CompactTree<Key, Value, Compare, KeysOnly>::find(const Key& key) {
+    return Iterator(this, findIndex(key));
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+bool CompactTree<Key, Value, Compare, KeysOnly>::contains(const Key& key) const {
+    return findIndex(key) != none;
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+typename CompactTree<Key, Value, Compare, KeysOnly>::Iterator CompactTree<Key, Value, Compare, KeysOnly>::lowerBound(const Key& key) {
+    return Iterator(this, lowerBoundIndex(key));
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+typename CompactTree<Key, Value, Compare, KeysOnly>::ConstIterator CompactTree<Key, Value, Compare, KeysOnly>::lowerBound(const Key& key) const {
+    return ConstIterator(this, lowerBoundIndex(key));
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+typename CompactTree<Key, Value, Compare, KeysOnly>::Iterator CompactTree<Key, Value, Compare, KeysOnly>::upperBound(const Key& key) {
+    return Iterator(this, upperBoundIndex(key));
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+typename CompactTree<Key, Value, Compare, KeysOnly>::ConstIterator CompactTree<Key, Value, Compare, KeysOnly>::upperBound(const Key& key) const {
+    return ConstIterator(this, upperBoundIndex(key));
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+std::pair<typename CompactTree<Key, Value, Compare, KeysOnly>::Iterator, typename CompactTree<Key, Value, Compare, KeysOnly>::Iterator>
+        CompactTree<Key, Value, Compare, KeysOnly>::equalRange(const Key& key) {
+    return std::make_pair(lowerBound(key), upperBound(key));
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+std::pair<typename CompactTree<Key, Value, Compare, KeysOnly>::ConstIterator, typename CompactTree<Key, Value, Compare, KeysOnly>::ConstIterator>
+        CompactTree<Key, Value, Compare, KeysOnly>::equalRange(const Key& key) const {
+    return std::make_pair(lowerBound(key), upperBound(key));
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+typename CompactTree<Key, Value, Compare, KeysOnly>::Iterator CompactTree<Key, Value, Compare, KeysOnly>::begin() {
+    return Iterator(this, _root != none ? leftmost(_root) : none);
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+typename CompactTree<Key, Value, Compare, KeysOnly>::Iterator CompactTree<Key, Value, Compare, KeysOnly>::end() {
+    return Iterator(this, none);
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+typename CompactTree<Key, Value, Compare, KeysOnly>::ConstIterator CompactTree<Key, Value, Compare, KeysOnly>::cbegin() const {
+    return ConstIterator(this, _root != none ? leftmost(_root) : none);
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+typename CompactTree<Key, Value, Compare, KeysOnly>::ConstIterator CompactTree<Key, Value, Compare, KeysOnly>::cend() const {
+    return ConstIterator(this, none);
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+std::size_t CompactTree<Key, Value, Compare, KeysOnly>::size() const {
+    return _nodes.size();
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+std::size_t CompactTree<Key, Value, Compare, KeysOnly>::memoryUsage() const {
+    return _nodes.capacity() * sizeof(Node);
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+void CompactTree<Key, Value, Compare, KeysOnly>::clear() {
+    _nodes.clear();
+    _root = none;
+    _maxSize = 0;
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+const Compare& CompactTree<Key, Value, Compare, KeysOnly>::keyCompare() const {
+    return _compare;
+}
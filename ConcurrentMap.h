@@ -0,0 +1,119 @@
+#ifndef BST_CONCURRENT_MAP_H
+#define BST_CONCURRENT_MAP_H
+
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <type_traits>
+#include "map.h"
+
+// Whether keys that Compare finds equivalent are exactly the equal ones, so
+// that std::hash picks the same shard for them.
+template <typename Compare, typename Key>
+struct ComparesByEquality : std::bool_constant<std::is_same_v<Compare, std::less<Key>> ||
+                                               std::is_same_v<Compare, std::greater<Key>> ||
+                                               std::is_same_v<Compare, std::less<>> ||
+                                               std::is_same_v<Compare, std::greater<>>>
+{
+};
+
+// Map that can be shared between threads. Keys are striped over Shards
+// independent maps by hash, each behind its own reader/writer lock, so
+// readers only contend with writers of the same shard and writers to
+// different shards run in parallel. Lookups return copies, since an iterator
+// would not stay valid once the lock is released.
+// Hash must give keys that Tree::KeyCompare finds equivalent the same hash,
+// or they land in different shards; for a coarser comparator, such as a
+// case-insensitive one, pass a Hash to match.
+template <typename Key,
+          typename Value,
+          typename Tree = BinarySearchTree<Key, Value>,
+          std::size_t Shards = 16,
+          typename Hash = std::hash<Key>>
+class ConcurrentMap
+{
+    static_assert(!std::is_same_v<Hash, std::hash<Key>> || ComparesByEquality<typename Tree::KeyCompare, Key>::value,
+                  "std::hash only agrees with comparators whose equivalence is equality; pass a matching Hash");
+
+    struct alignas(64) Shard
+    {
+        mutable std::shared_mutex mutex;
+        Map<Key, Value, Tree> map;
+    };
+
+    std::array<Shard, Shards> _shards;
+    Hash _hash;
+
+    Shard& shardFor(const Key& key);
+    const Shard& shardFor(const Key& key) const;
+
+public:
+    ConcurrentMap() = default;
+    ~ConcurrentMap() = default;
+
+    void insert(const Key& key, const Value& value);
+    std::size_t erase(const Key& key);
+
+    std::optional<Value> find(const Key& key) const;
+    bool contains(const Key& key) const;
+
+    std::size_t size() const;
+};
+
+template<typename Key, typename Value, typename Tree, std::size_t Shards, typename Hash>
+typename ConcurrentMap<Key, Value, Tree, Shards, Hash>::Shard& ConcurrentMap<Key, Value, Tree, Shards, Hash>::shardFor(const Key &key) {
+    return _shards[_hash(key) % Shards];
+}
+
+template<typename Key, typename Value, typename Tree, std::size_t Shards, typename Hash>
+const typename ConcurrentMap<Key, Value, Tree, Shards, Hash>::Shard&
+        ConcurrentMap<Key, Value, Tree, Shards, Hash>::shardFor(const Key &key) const {
+    return _shards[_hash(key) % Shards];
+}
+
+template<typename Key, typename Value, typename Tree, std::size_t Shards, typename Hash>
+void ConcurrentMap<Key, Value, Tree, Shards, Hash>::insert(const Key &key, const Value &value) {
+    Shard& shard = shardFor(key);
+    std::unique_lock lock(shard.mutex);
+    shard.map.insert(key, value);
+}
+
+template<typename Key, typename Value, typename Tree, std::size_t Shards, typename Hash>
+std::size_t ConcurrentMap<Key, Value, Tree, Shards, Hash>::erase(const Key &key) {
+    Shard& shard = shardFor(key);
+    std::unique_lock lock(shard.mutex);
+    return shard.map.erase(key);
+}
+
+template<typename Key, typename Value, typename Tree, std::size_t Shards, typename Hash>
+std::optional<Value> ConcurrentMap<Key, Value, Tree, Shards, Hash>::find(const Key &key) const {
+    const Shard& shard = shardFor(key);
+    std::shared_lock lock(shard.mutex);
+    auto iterator = shard.map.find(key);
+    if (iterator == shard.map.cend()) {
+        return std::nullopt;
+    }
+    return iterator->second;
+}
+
+template<typename Key, typename Value, typename Tree, std::size_t Shards, typename Hash>
+bool ConcurrentMap<Key, Value, Tree, Shards, Hash>::contains(const Key &key) const {
+    const Shard& shard = shardFor(key);
+    std::shared_lock lock(shard.mutex);
+    return shard.map.find(key) != shard.map.cend();
+}
+
+template<typename Key, typename Value, typename Tree, std::size_t Shards, typename Hash>
+std::size_t ConcurrentMap<Key, Value, Tree, Shards, Hash>::size() const {
+    std::size_t size = 0;
+    for (const Shard& shard : _shards) {
+        std::shared_lock lock(shard.mutex);
+        size += shard.map.size();
+    }
+    return size;
+}
+
+#endif //BST_CONCURRENT_MAP_H
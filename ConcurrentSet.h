@@ -0,0 +1,47 @@
+#ifndef BST_CONCURRENT_SET_H
+#define BST_CONCURRENT_SET_H
+
+#include "ConcurrentMap.h"
+
+// Hash must agree with Tree::KeyCompare, see ConcurrentMap.
+template <typename Value,
+          typename Tree = BinarySearchTree<Value, Value>,
+          std::size_t Shards = 16,
+          typename Hash = std::hash<Value>>
+class ConcurrentSet
+{
+    ConcurrentMap<Value, Value, Tree, Shards, Hash> _map;
+
+public:
+    ConcurrentSet() = default;
+    ~ConcurrentSet() = default;
+
+    void insert(const Value& value);
+    std::size_t erase(const Value& value);
+
+    bool contains(const Value& value) const;
+
+    std::size_t size() const;
+};
+
+template<typename Value, typename Tree, std::size_t Shards, typename Hash>
+void ConcurrentSet<Value, Tree, Shards, Hash>::insert(const Value &value) {
+    _map.insert(value, value);
+}
+
+template<typename Value, typename Tree, std::size_t Shards, typename Hash>
+std::size_t ConcurrentSet<Value, Tree, Shards, Hash>::erase(const Value &value) {
+    return _map.erase(value);
+}
+
+template<typename Value, typename Tree, std::size_t Shards, typename Hash>
+bool ConcurrentSet<Value, Tree, Shards, Hash>::contains(const Value &value) const {
+    return _map.contains(value);
+}
+
+template<typename Value, typename Tree, std::size_t Shards, typename Hash>
+std::size_t ConcurrentSet<Value, Tree, Shards, Hash>::size() const {
+    return _map.size();
+}
+
+#endif //BST_CONCURRENT_SET_H
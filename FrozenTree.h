@@ -0,0 +1,358 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Allocator returning cache line aligned storage, so that in FrozenTree the
+// children four levels down (for 4-byte keys) share a single line.
+template <typename T>
+struct CacheLineAllocator
+{
+    using value_type = T;
+
+    static constexpr std::size_t lineSize = 64;
+
+    CacheLineAllocator() = default;
+    template<typename U>
+    CacheLineAllocator(const CacheLineAllocator<U>&) {}
+
+    T* allocate(std::size_t count);
+    void deallocate(T* pointer, std::size_t count);
+
+    template<typename U>
+    bool operator==(const CacheLineAllocator<U>&) const { return true; }
+    template<typename U>
+    bool operator!=(const CacheLineAllocator<U>&) const { return false; }
+};
+
+// Immutable sorted map in Eytzinger order: the element at slot k has its
+// children at 2k and 2k + 1, so the top of the tree shares a few cache lines
+// and the descent is pure index arithmetic. Searches are branch free (the
+// comparison result is added to the index) and prefetch the keys several
+// levels ahead. Keys sit apart from values, so a cache line holds as many
+// keys as possible. Built from sorted input, see BinarySearchTree::freeze;
+// equal keys are kept in order. With KeysOnly no values are stored.
+template <typename Key, typename Value, typename Compare = std::less<Key>, bool KeysOnly = false>
+class FrozenTree
+{
+    static_assert(!KeysOnly || std::is_same_v<Key, Value>, "KeysOnly trees map every key to itself");
+
+    template <typename Reference>
+    struct ArrowProxy
+    {
+        Reference reference;
+        Reference* operator->();
+    };
+
+    // Descendants that many levels down fill one cache line.
+    static constexpr std::size_t prefetchStride();
+
+    std::size_t successor(std::size_t slot) const;
+    std::size_t predecessor(std::size_t slot) const;
+    std::size_t first() const;
+    std::size_t lowerBoundSlot(const Key& key) const;
+    std::size_t upperBoundSlot(const Key& key) const;
+
+    // Slot 0 is unused; slots 1..size hold the elements.
+    std::vector<Key, CacheLineAllocator<Key>> _keys;
+    std::vector<Value> _values;
+    std::size_t _size = 0;
+    Compare _compare;
+
+public:
+    using KeyCompare = Compare;
+
+    class ConstIterator
+    {
+    public:
+        ConstIterator(const FrozenTree* tree = nullptr, std::size_t slot = 0);
+
+        std::pair<const Key&, const Value&> operator*() const;
+        ArrowProxy<std::pair<const Key&, const Value&>> operator->() const;
+
+        ConstIterator operator++();
+        ConstIterator operator++(int);
+
+        ConstIterator operator--();
+        ConstIterator operator--(int);
+
+        bool operator==(const ConstIterator& other) const;
+        bool operator!=(const ConstIterator& other) const;
+
+    private:
+        const FrozenTree* _tree;
+        std::size_t _slot;
+    };
+
+    FrozenTree() = default;
+
+    // Copies [first, last), whose entries expose .first and .second and must
+    // be sorted by key; throws std::invalid_argument otherwise.
+    template<typename InputIterator>
+    FrozenTree(InputIterator first, InputIterator last, const Compare& compare = Compare());
+
+    ConstIterator find(const Key& key) const;
+    bool contains(const Key& key) const;
+    ConstIterator lowerBound(const Key& key) const;
+    ConstIterator upperBound(const Key& key) const;
+    std::pair<ConstIterator, ConstIterator> equalRange(const Key& key) const;
+
+    ConstIterator begin() const;
+    ConstIterator end() const;
+
+    ConstIterator cbegin() const;
+    ConstIterator cend() const;
+
+    std::size_t size() const;
+    const Compare& keyCompare() const;
+};
+
+template<typename T>
+T* CacheLineAllocator<T>::allocate(std::size_t count) {
+    return static_cast<T*>(::operator new(count * sizeof(T), std::align_val_t(std::max(lineSize, alignof(T)))));
+}
+
+template<typename T>
+void CacheLineAllocator<T>::deallocate(T* pointer, std::size_t) {
+    ::operator delete(pointer, std::align_val_t(std::max(lineSize, alignof(T))));
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+template<typename Reference>
+Reference* FrozenTree<Key, Value, Compare, KeysOnly>::ArrowProxy<Reference>::operator->() {
+    return &reference;
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+constexpr std::size_t FrozenTree<Key, Value, Compare, KeysOnly>::prefetchStride() {
+    std::size_t stride = 1;
+    while (stride * 2 * sizeof(Key) <= CacheLineAllocator<Key>::lineSize) {
+        stride *= 2;
+    }
+    return stride;
+}
+
+// In-order neighbours: down one step and then all the way the other way,
+// or up past every ancestor reached from that side.
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+std::size_t FrozenTree<Key, Value, Compare, KeysOnly>::successor(std::size_t slot) const {
+    if (2 * slot + 1 <= _size) {
+        slot = 2 * slot + 1;
+        while (2 * slot <= _size) {
+            slot = 2 * slot;
+        }
+        return slot;
+    }
+    while ((slot & 1) != 0) {
+        slot >>= 1;
+    }
+    return slot >> 1;
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+std::size_t FrozenTree<Key, Value, Compare, KeysOnly>::predecessor(std::size_t slot) const {
+    if (2 * slot <= _size) {
+        slot = 2 * slot;
+        while (2 * slot + 1 <= _size) {
+            slot = 2 * slot + 1;
+        }
+        return slot;
+    }
+    while ((slot & 1) == 0) {
+        slot >>= 1;
+    }
+    return slot >> 1;
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+std::size_t FrozenTree<Key, Value, Compare, KeysOnly>::first() const {
+    std::size_t slot = _size > 0 ? 1 : 0;
+    while (slot != 0 && 2 * slot <= _size) {
+        slot = 2 * slot;
+    }
+    return slot;
+}
+
+// The descent goes right past every key less than key; the answer is the
+// last slot where it went left, found by dropping the trailing right turns
+// and one more step from the final index.
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+std::size_t FrozenTree<Key, Value, Compare, KeysOnly>::lowerBoundSlot(const Key& key) const {
+    const Key* keys = _keys.data();
+    std::size_t slot = 1;
+    while (slot <= _size) {
+        __builtin_prefetch(keys + std::min(slot * prefetchStride(), _size));
+        slot = 2 * slot + static_cast<std::size_t>(_compare(keys[slot], key));
+    }
+    return slot >> __builtin_ffsll(static_cast<long long>(~slot));
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+std::size_t FrozenTree<Key, Value, Compare, KeysOnly>::upperBoundSlot(const Key& key) const {
+    const Key* keys = _keys.data();
+    std::size_t slot = 1;
+    while (slot <= _size) {
+        __builtin_prefetch(keys + std::min(slot * prefetchStride(), _size));
+        slot = 2 * slot + static_cast<std::size_t>(!_compare(key, keys[slot]));
+    }
+    return slot >> __builtin_ffsll(static_cast<long long>(~slot));
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+template<typename InputIterator>
+FrozenTree<Key, Value, Compare, KeysOnly>::FrozenTree(InputIterator first, InputIterator last,
+                                                      const Compare& compare): _compare(compare) {
+    std::vector<Key> keys;
+    std::vector<Value> values;
+    for (; first != last; ++first) {
+        auto&& entry = *first;
+        if (!keys.empty() && _compare(entry.first, keys.back())) {
+            throw std::invalid_argument("Keys are not sorted!");
+        }
+        keys.push_back(entry.first);
+        if constexpr (!KeysOnly) {
+            values.push_back(entry.second);
+        }
+    }
+    _size = keys.size();
+    if (_size == 0) {
+        return;
+    }
+    _keys.assign(_size + 1, keys.front());
+    if constexpr (!KeysOnly) {
+        _values.assign(_size + 1, values.front());
+    }
+    std::size_t slot = this->first();
+    for (std::size_t i = 0; i < _size; i++) {
+        _keys[slot] = std::move(keys[i]);
+        if constexpr (!KeysOnly) {
+            _values[slot] = std::move(values[i]);
+        }
+        slot = successor(slot);
+    }
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+FrozenTree<Key, Value, Compare, KeysOnly>::ConstIterator::ConstIterator(const FrozenTree* tree, std::size_t slot):
+        _tree(tree), _slot(slot) {
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+std::pair<const Key&, const Value&> FrozenTree<Key, Value, Compare, KeysOnly>::ConstIterator::operator*() const {
+    if constexpr (KeysOnly) {
+        return {_tree->_keys[_slot], _tree->_keys[_slot]};
+    }
+    else {
+        return {_tree->_keys[_slot], _tree->_values[_slot]};
+    }
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+typename FrozenTree<Key, Value, Compare, KeysOnly>::template ArrowProxy<std::pair<const Key&, const Value&>>
+        FrozenTree<Key, Value, Compare, KeysOnly>::ConstIterator::operator->() const {
+    return {**this};
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+typename FrozenTree<Key, Value, Compare, KeysOnly>::ConstIterator FrozenTree<Key, Value, Compare, KeysOnly>::ConstIterator::operator++() {
+    if (_slot != 0) {
+        _slot = _tree->successor(_slot);
+    }
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+typename FrozenTree<Key, Value, Compare, KeysOnly>::ConstIterator FrozenTree<Key, Value, Compare, KeysOnly>::ConstIterator::operator++(int) {
+    ConstIterator previous = *this;
+    ++(*this);
+    return previous;
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+typename FrozenTree<Key, Value, Compare, KeysOnly>::ConstIterator FrozenTree<Key, Value, Compare, KeysOnly>::ConstIterator::operator--() {
+    if (_slot != 0) {
+        _slot = _tree->predecessor(_slot);
+    }
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+typename FrozenTree<Key, Value, Compare, KeysOnly>::ConstIterator FrozenTree<Key, Value, Compare, KeysOnly>::ConstIterator::operator--(int) {
+    ConstIterator previous = *this;
+    --(*this);
+    return previous;
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+bool FrozenTree<Key, Value, Compare, KeysOnly>::ConstIterator::operator==(const FrozenTree::ConstIterator& other) const {
+    return _slot == other._slot;
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+bool FrozenTree<Key, Value, Compare, KeysOnly>::ConstIterator::operator!=(const FrozenTree::ConstIterator& other) const {
+    return !(*this == other);
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+typename FrozenTree<Key, Value, Compare, KeysOnly>::ConstIterator FrozenTree<Key, Value, Compare, KeysOnly>::find(const Key& key) const {
+    std::size_t slot = lowerBoundSlot(key);
+    return ConstIterator(this, slot != 0 && !_compare(key, _keys[slot]) ? slot : 0);
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+bool FrozenTree<Key, Value, Compare, KeysOnly>::contains(const Key& key) const {
+    return find(key) != cend();
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+typename FrozenTree<Key, Value, Compare, KeysOnly>::ConstIterator FrozenTree<Key, Value, Compare, KeysOnly>::lowerBound(const Key& key) const {
+    return ConstIterator(this, lowerBoundSlot(key));
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+typename FrozenTree<Key, Value, Compare, KeysOnly>::ConstIterator FrozenTree<Key, Value, Compare, KeysOnly>::upperBound(const Key& key) const {
+    return ConstIterator(this, upperBoundSlot(key));
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+std::pair<typename FrozenTree<Key, Value, Compare, KeysOnly>::ConstIterator, typename FrozenTree<Key, Value, Compare, KeysOnly>::ConstIterator>
+        FrozenTree<Key, Value, Compare, KeysOnly>::equalRange(const Key& key) const {
+    return std::make_pair(lowerBound(key), upperBound(key));
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+typename FrozenTree<Key, Value, Compare, KeysOnly>::ConstIterator FrozenTree<Key, Value, Compare, KeysOnly>::begin() const {
+    return cbegin();
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+typename FrozenTree<Key, Value, Compare, KeysOnly>::ConstIterator FrozenTree<Key, Value, Compare, KeysOnly>::end() const {
+    return cend();
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+typename FrozenTree<Key, Value, Compare, KeysOnly>::ConstIterator FrozenTree<Key, Value, Compare, KeysOnly>::cbegin() const {
+    return ConstIterator(this, first());
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+typename FrozenTree<Key, Value, Compare, KeysOnly>::ConstIterator FrozenTree<Key, Value, Compare, KeysOnly>::cend() const {
+    return ConstIterator(this, 0);
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+std::size_t FrozenTree<Key, Value, Compare, KeysOnly>::size() const {
+    return _size;
+}
+
+template<typename Key, typename Value, typename Compare, bool KeysOnly>
+const Compare& FrozenTree<Key, Value, Compare, KeysOnly>::keyCompare() const {
+    return _compare;
+}
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Position search inside a sorted block of keys, used by wide tree nodes.
+// Generic keys use binary search. Arithmetic keys count the keys below the
+// probe instead, which is branch free and, for 32/64-bit integers, float and
+// double, compares a whole vector of keys per instruction (AVX2 when the
+// compiler targets it, SSE otherwise, scalar as the fallback).
+template <typename Key, typename = void>
+struct KeySearch
+{
+    static std::size_t lowerBound(const Key* keys, std::size_t count, const Key& key);
+    static std::size_t upperBound(const Key* keys, std::size_t count, const Key& key);
+};
+
+template <typename Key>
+struct KeySearch<Key, std::enable_if_t<std::is_arithmetic_v<Key>>>
+{
+    static std::size_t lowerBound(const Key* keys, std::size_t count, Key key);
+    static std::size_t upperBound(const Key* keys, std::size_t count, Key key);
+
+private:
+    static std::size_t countLess(const Key* keys, std::size_t count, Key key);
+    static std::size_t countGreater(const Key* keys, std::size_t count, Key key);
+};
+
+template<typename Key, typename Enable>
+std::size_t KeySearch<Key, Enable>::lowerBound(const Key* keys, std::size_t count, const Key& key) {
+    return std::lower_bound(keys, keys + count, key) - keys;
+}
+
+template<typename Key, typename Enable>
+std::size_t KeySearch<Key, Enable>::upperBound(const Key* keys, std::size_t count, const Key& key) {
+    return std::upper_bound(keys, keys + count, key) - keys;
+}
+
+template<typename Key>
+std::size_t KeySearch<Key, std::enable_if_t<std::is_arithmetic_v<Key>>>::lowerBound(const Key* keys,
+                                                                                      std::size_t count, Key key) {
+    return countLess(keys, count, key);
+}
+
+template<typename Key>
+std::size_t KeySearch<Key, std::enable_if_t<std::is_arithmetic_v<Key>>>::upperBound(const Key* keys,
+                                                                                      std::size_t count, Key key) {
+    return count - countGreater(keys, count, key);
+}
+
+template<typename Key>
+std::size_t KeySearch<Key, std::enable_if_t<std::is_arithmetic_v<Key>>>::countLess(const Key* keys,
+                                                                                     std::size_t count, Key key) {
+    std::size_t less = 0;
+    std::size_t i = 0;
+#if defined(__AVX2__)
+    if constexpr (std::is_integral_v<Key> && sizeof(Key) == 4) {
+        const __m256i bias = _mm256_set1_epi32(std::is_signed_v<Key> ? 0 : INT32_MIN);
+        const __m256i probe = _mm256_xor_si256(_mm256_set1_epi32(static_cast<std::int32_t>(key)), bias);
+        for (; i + 8 <= count; i += 8) {
+            __m256i block = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i)), bias);
+            less += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(probe, block))));
+        }
+    }
+    else if constexpr (std::is_integral_v<Key> && sizeof(Key) == 8) {
+        const __m256i bias = _mm256_set1_epi64x(std::is_signed_v<Key> ? 0 : INT64_MIN);
+        const __m256i probe = _mm256_xor_si256(_mm256_set1_epi64x(static_cast<std::int64_t>(key)), bias);
+        for (; i + 4 <= count; i += 4) {
+            __m256i block = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i)), bias);
+            less += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(probe, block))));
+        }
+    }
+    else if constexpr (std::is_same_v<Key, float>) {
+        const __m256 probe = _mm256_set1_ps(key);
+        for (; i + 8 <= count; i += 8) {
+            less += __builtin_popcount(_mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(keys + i), probe, _CMP_LT_OQ)));
+        }
+    }
+    else if constexpr (std::is_same_v<Key, double>) {
+        const __m256d probe = _mm256_set1_pd(key);
+        for (; i + 4 <= count; i += 4) {
+            less += __builtin_popcount(_mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(keys + i), probe, _CMP_LT_OQ)));
+        }
+    }
+#elif defined(__SSE2__)
+    if constexpr (std::is_integral_v<Key> && sizeof(Key) == 4) {
+        const __m128i bias = _mm_set1_epi32(std::is_signed_v<Key> ? 0 : INT32_MIN);
+        const __m128i probe = _mm_xor_si128(_mm_set1_epi32(static_cast<std::int32_t>(key)), bias);
+        for (; i + 4 <= count; i += 4) {
+            __m128i block = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i)), bias);
+            less += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(probe, block))));
+        }
+    }
+    else if constexpr (std::is_same_v<Key, float>) {
+        const __m128 probe = _mm_set1_ps(key);
+        for (; i + 4 <= count; i += 4) {
+            less += __builtin_popcount(_mm_movemask_ps(_mm_cmplt_ps(_mm_loadu_ps(keys + i), probe)));
+        }
+    }
+    else if constexpr (std::is_same_v<Key, double>) {
+        const __m128d probe = _mm_set1_pd(key);
+        for (; i + 2 <= count; i += 2) {
+            less += __builtin_popcount(_mm_movemask_pd(_mm_cmplt_pd(_mm_loadu_pd(keys + i), probe)));
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        less += keys[i] < key;
+    }
+    return less;
+}
+
+template<typename Key>
+std::size_t KeySearch<Key, std::enable_if_t<std::is_arithmetic_v<Key>>>::countGreater(const Key* keys,
+                                                                                        std::size_t count, Key key) {
+    std::size_t greater = 0;
+    std::size_t i = 0;
+#if defined(__AVX2__)
+    if constexpr (std::is_integral_v<Key> && sizeof(Key) == 4) {
+        const __m256i bias = _mm256_set1_epi32(std::is_signed_v<Key> ? 0 : INT32_MIN);
+        const __m256i probe = _mm256_xor_si256(_mm256_set1_epi32(static_cast<std::int32_t>(key)), bias);
+        for (; i + 8 <= count; i += 8) {
+            __m256i block = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i)), bias);
+            greater += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(block, probe))));
+        }
+    }
+    else if constexpr (std::is_integral_v<Key> && sizeof(Key) == 8) {
+        const __m256i bias = _mm256_set1_epi64x(std::is_signed_v<Key> ? 0 : INT64_MIN);
+        const __m256i probe = _mm256_xor_si256(_mm256_set1_epi64x(static_cast<std::int64_t>(key)), bias);
+        for (; i + 4 <= count; i += 4) {
+            __m256i block = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i)), bias);
+            greater += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(block, probe))));
+        }
+    }
+    else if constexpr (std::is_same_v<Key, float>) {
+        const __m256 probe = _mm256_set1_ps(key);
+        for (; i + 8 <= count; i += 8) {
+            greater += __builtin_popcount(_mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(keys + i), probe, _CMP_GT_OQ)));
+        }
+    }
+    else if constexpr (std::is_same_v<Key, double>) {
+        const __m256d probe = _mm256_set1_pd(key);
+        for (; i + 4 <= count; i += 4) {
+            greater += __builtin_popcount(_mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(keys + i), probe, _CMP_GT_OQ)));
+        }
+    }
+#elif defined(__SSE2__)
+    if constexpr (std::is_integral_v<Key> && sizeof(Key) == 4) {
+        const __m128i bias = _mm_set1_epi32(std::is_signed_v<Key> ? 0 : INT32_MIN);
+        const __m128i probe = _mm_xor_si128(_mm_set1_epi32(static_cast<std::int32_t>(key)), bias);
+        for (; i + 4 <= count; i += 4) {
+            __m128i block = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i)), bias);
+            greater += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(block, probe))));
+        }
+    }
+    else if constexpr (std::is_same_v<Key, float>) {
+        const __m128 probe = _mm_set1_ps(key);
+        for (; i + 4 <= count; i += 4) {
+            greater += __builtin_popcount(_mm_movemask_ps(_mm_cmpgt_ps(_mm_loadu_ps(keys + i), probe)));
+        }
+    }
+    else if constexpr (std::is_same_v<Key, double>) {
+        const __m128d probe = _mm_set1_pd(key);
+        for (; i + 2 <= count; i += 2) {
+            greater += __builtin_popcount(_mm_movemask_pd(_mm_cmpgt_pd(_mm_loadu_pd(keys + i), probe)));
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        greater += key < keys[i];
+    }
+    return greater;
+}
@@ -0,0 +1,282 @@
+#ifndef BST_MAPPED_MAP_H
+#define BST_MAPPED_MAP_H
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Serialization.h"
+
+// Read-only map over a file written by BinarySearchTree/Map::save. The file
+// is mapped into memory and searched in place, so opening it costs no
+// parsing and processes mapping the same file share the page cache.
+// Duplicate keys from a saved multimap are kept and found by equalRange.
+// Compare must order keys the same way as the tree that saved the file.
+template <typename Key, typename Value, typename Compare = std::less<Key>>
+class MappedMap
+{
+    using Layout = SerializedLayout<Key, Value>;
+
+    template <typename Reference>
+    struct ArrowProxy
+    {
+        Reference reference;
+        Reference* operator->();
+    };
+
+    void* _data = nullptr;
+    std::size_t _length = 0;
+    const Key* _keys = nullptr;
+    const Value* _values = nullptr;
+    std::size_t _size = 0;
+    Compare _compare;
+
+    void unmap();
+
+public:
+    class ConstIterator
+    {
+    public:
+        ConstIterator(const Key* key = nullptr, const Value* value = nullptr);
+
+        std::pair<const Key&, const Value&> operator*() const;
+        ArrowProxy<std::pair<const Key&, const Value&>> operator->() const;
+
+        ConstIterator operator++();
+        ConstIterator operator++(int);
+
+        ConstIterator operator--();
+        ConstIterator operator--(int);
+
+        bool operator==(const ConstIterator& other) const;
+        bool operator!=(const ConstIterator& other) const;
+
+    private:
+        const Key* _key;
+        const Value* _value;
+    };
+
+    // Throws std::runtime_error if the file cannot be mapped or was not
+    // saved with the same Key and Value types.
+    explicit MappedMap(const std::string& path, const Compare& compare = Compare());
+    ~MappedMap();
+
+    MappedMap(const MappedMap& other) = delete;
+    MappedMap& operator=(const MappedMap& other) = delete;
+
+    MappedMap(MappedMap&& other) noexcept;
+    MappedMap& operator=(MappedMap&& other) noexcept;
+
+    ConstIterator find(const Key& key) const;
+    ConstIterator lowerBound(const Key& key) const;
+    ConstIterator upperBound(const Key& key) const;
+    std::pair<ConstIterator, ConstIterator> equalRange(const Key& key) const;
+    bool contains(const Key& key) const;
+
+    ConstIterator begin() const;
+    ConstIterator end() const;
+
+    ConstIterator cbegin() const;
+    ConstIterator cend() const;
+
+    std::size_t size() const;
+};
+
+template<typename Key, typename Value, typename Compare>
+template<typename Reference>
+Reference* MappedMap<Key, Value, Compare>::ArrowProxy<Reference>::operator->() {
+    return &reference;
+}
+
+template<typename Key, typename Value, typename Compare>
+MappedMap<Key, Value, Compare>::ConstIterator::ConstIterator(const Key* key, const Value* value): _key(key), _value(value) {
+}
+
+template<typename Key, typename Value, typename Compare>
+std::pair<const Key&, const Value&> MappedMap<Key, Value, Compare>::ConstIterator::operator*() const {
+    return {*_key, *_value};
+}
+
+template<typename Key, typename Value, typename Compare>
+typename MappedMap<Key, Value, Compare>::template ArrowProxy<std::pair<const Key&, const Value&>>
+        MappedMap<Key, Value, Compare>::ConstIterator::operator->() const {
+    return {**this};
+}
+
+template<typename Key, typename Value, typename Compare>
+typename MappedMap<Key, Value, Compare>::ConstIterator MappedMap<Key, Value, Compare>::ConstIterator::operator++() {
+    ++_key;
+    ++_value;
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename MappedMap<Key, Value, Compare>::ConstIterator MappedMap<Key, Value, Compare>::ConstIterator::operator++(int) {
+    ConstIterator previous = *this;
+    ++(*this);
+    return previous;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename MappedMap<Key, Value, Compare>::ConstIterator MappedMap<Key, Value, Compare>::ConstIterator::operator--() {
+    --_key;
+    --_value;
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename MappedMap<Key, Value, Compare>::ConstIterator MappedMap<Key, Value, Compare>::ConstIterator::operator--(int) {
+    ConstIterator previous = *this;
+    --(*this);
+    return previous;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool MappedMap<Key, Value, Compare>::ConstIterator::operator==(const ConstIterator& other) const {
+    return _key == other._key;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool MappedMap<Key, Value, Compare>::ConstIterator::operator!=(const ConstIterator& other) const {
+    return _key != other._key;
+}
+
+template<typename Key, typename Value, typename Compare>
+MappedMap<Key, Value, Compare>::MappedMap(const std::string& path, const Compare& compare): _compare(compare) {
+    int file = ::open(path.c_str(), O_RDONLY);
+    if (file < 0) {
+        throw std::runtime_error("Failed to open " + path + "!");
+    }
+    struct stat status{};
+    if (::fstat(file, &status) != 0 || static_cast<std::size_t>(status.st_size) < sizeof(SerializedHeader)) {
+        ::close(file);
+        throw std::runtime_error("Failed to read " + path + "!");
+    }
+    _length = status.st_size;
+    void* data = ::mmap(nullptr, _length, PROT_READ, MAP_SHARED, file, 0);
+    ::close(file);
+    if (data == MAP_FAILED) {
+        throw std::runtime_error("Failed to map " + path + "!");
+    }
+    _data = data;
+    try {
+        const auto* header = static_cast<const SerializedHeader*>(_data);
+        Layout::check(*header);
+        // Bounding the count by the length first keeps the offsets below
+        // from overflowing.
+        if (header->count > Layout::maxCount(_length)) {
+            throw std::runtime_error("Serialized tree is truncated!");
+        }
+        _size = header->count;
+        if (_length < Layout::fileSize(_size)) {
+            throw std::runtime_error("Serialized tree is truncated!");
+        }
+    }
+    catch (...) {
+        unmap();
+        throw;
+    }
+    const char* bytes = static_cast<const char*>(_data);
+    _keys = reinterpret_cast<const Key*>(bytes + Layout::keysOffset());
+    _values = reinterpret_cast<const Value*>(bytes + Layout::valuesOffset(_size));
+}
+
+template<typename Key, typename Value, typename Compare>
+MappedMap<Key, Value, Compare>::~MappedMap() {
+    unmap();
+}
+
+template<typename Key, typename Value, typename Compare>
+MappedMap<Key, Value, Compare>::MappedMap(MappedMap&& other) noexcept: _compare(other._compare) {
+    *this = std::move(other);
+}
+
+template<typename Key, typename Value, typename Compare>
+MappedMap<Key, Value, Compare>& MappedMap<Key, Value, Compare>::operator=(MappedMap&& other) noexcept {
+    std::swap(_data, other._data);
+    std::swap(_length, other._length);
+    std::swap(_keys, other._keys);
+    std::swap(_values, other._values);
+    std::swap(_size, other._size);
+    std::swap(_compare, other._compare);
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare>
+void MappedMap<Key, Value, Compare>::unmap() {
+    if (_data != nullptr) {
+        ::munmap(_data, _length);
+    }
+    _data = nullptr;
+    _length = 0;
+    _keys = nullptr;
+    _values = nullptr;
+    _size = 0;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename MappedMap<Key, Value, Compare>::ConstIterator MappedMap<Key, Value, Compare>::find(const Key& key) const {
+    ConstIterator bound = lowerBound(key);
+    if (bound != cend() && !_compare(key, bound->first)) {
+        return bound;
+    }
+    return cend();
+}
+
+template<typename Key, typename Value, typename Compare>
+typename MappedMap<Key, Value, Compare>::ConstIterator MappedMap<Key, Value, Compare>::lowerBound(const Key& key) const {
+    std::size_t index = std::lower_bound(_keys, _keys + _size, key, _compare) - _keys;
+    return ConstIterator(_keys + index, _values + index);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename MappedMap<Key, Value, Compare>::ConstIterator MappedMap<Key, Value, Compare>::upperBound(const Key& key) const {
+    std::size_t index = std::upper_bound(_keys, _keys + _size, key, _compare) - _keys;
+    return ConstIterator(_keys + index, _values + index);
+}
+
+template<typename Key, typename Value, typename Compare>
+std::pair<typename MappedMap<Key, Value, Compare>::ConstIterator, typename MappedMap<Key, Value, Compare>::ConstIterator>
+        MappedMap<Key, Value, Compare>::equalRange(const Key& key) const {
+    return std::make_pair(lowerBound(key), upperBound(key));
+}
+
+template<typename Key, typename Value, typename Compare>
+bool MappedMap<Key, Value, Compare>::contains(const Key& key) const {
+    return find(key) != cend();
+}
+
+template<typename Key, typename Value, typename Compare>
+typename MappedMap<Key, Value, Compare>::ConstIterator MappedMap<Key, Value, Compare>::begin() const {
+    return cbegin();
+}
+
+template<typename Key, typename Value, typename Compare>
+typename MappedMap<Key, Value, Compare>::ConstIterator MappedMap<Key, Value, Compare>::end() const {
+    return cend();
+}
+
+template<typename Key, typename Value, typename Compare>
+typename MappedMap<Key, Value, Compare>::ConstIterator MappedMap<Key, Value, Compare>::cbegin() const {
+    return ConstIterator(_keys, _values);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename MappedMap<Key, Value, Compare>::ConstIterator MappedMap<Key, Value, Compare>::cend() const {
+    return ConstIterator(_keys + _size, _values + _size);
+}
+
+template<typename Key, typename Value, typename Compare>
+std::size_t MappedMap<Key, Value, Compare>::size() const {
+    return _size;
+}
+
+#endif //BST_MAPPED_MAP_H
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <future>
+#include <thread>
+#include <vector>
+
+// Inputs shorter than this are not worth handing to other threads.
+constexpr std::size_t parallelThreshold = 1 << 16;
+
+inline std::size_t workerCount() {
+    std::size_t hardware = std::thread::hardware_concurrency();
+    return hardware != 0 ? hardware : 1;
+}
+
+// Calls function(begin, end) on consecutive slices of [0, count), running the
+// slices on separate threads when count is large enough to pay for them.
+template <typename Function>
+void parallelFor(std::size_t count, Function function) {
+    std::size_t slices = std::min(workerCount(), count / parallelThreshold);
+    if (slices <= 1) {
+        function(std::size_t(0), count);
+        return;
+    }
+    std::vector<std::future<void>> tasks;
+    for (std::size_t i = 0; i < slices; i++) {
+        tasks.push_back(std::async(std::launch::async, [&function, count, slices, i] {
+            function(count * i / slices, count * (i + 1) / slices);
+        }));
+    }
+    for (auto& task : tasks) {
+        task.get();
+    }
+}
+
+// Runs first and second, the first one on another thread when parallel is set.
+template <typename First, typename Second>
+void parallelInvoke(bool parallel, First first, Second second) {
+    if (!parallel) {
+        first();
+        second();
+        return;
+    }
+    std::future<void> task = std::async(std::launch::async, first);
+    second();
+    task.get();
+}
+
+// Stable sort that sorts up to workerCount() slices concurrently and then
+// merges neighbouring slices pairwise, also concurrently.
+template <typename RandomIterator, typename Compare>
+void parallelStableSort(RandomIterator first, RandomIterator last, Compare compare) {
+    std::size_t count = last - first;
+    std::size_t slices = 1;
+    while (slices * 2 <= workerCount() && count / (slices * 2) >= parallelThreshold) {
+        slices *= 2;
+    }
+    if (slices == 1) {
+        std::stable_sort(first, last, compare);
+        return;
+    }
+    std::vector<RandomIterator> bounds;
+    for (std::size_t i = 0; i <= slices; i++) {
+        bounds.push_back(first + count * i / slices);
+    }
+    std::vector<std::future<void>> tasks;
+    for (std::size_t i = 0; i < slices; i++) {
+        tasks.push_back(std::async(std::launch::async, [&bounds, &compare, i] {
+            std::stable_sort(bounds[i], bounds[i + 1], compare);
+        }));
+    }
+    for (auto& task : tasks) {
+        task.get();
+    }
+    for (std::size_t width = 1; width < slices; width *= 2) {
+        tasks.clear();
+        for (std::size_t i = 0; i + width < slices; i += 2 * width) {
+            tasks.push_back(std::async(std::launch::async, [&bounds, &compare, i, width, slices] {
+                std::inplace_merge(bounds[i], bounds[i + width], bounds[std::min(i + 2 * width, slices)], compare);
+            }));
+        }
+        for (auto& task : tasks) {
+            task.get();
+        }
+    }
+}
@@ -0,0 +1,461 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Persistent AVL multimap ordered by Compare. Nodes are immutable and shared
+// between versions through reference counts, so insert and erase copy only
+// the O(log n) nodes on the search path (erase rejoins the nodes around a run
+// of duplicates instead of descending once per element), and snapshot() (or
+// any copy) takes O(1). A snapshot
+// never observes later changes to the tree it was taken from and may be read
+// from another thread while the original keeps being modified.
+template <typename Key, typename Value, typename Compare = std::less<Key>>
+class PersistentTree
+{
+    struct Node;
+    using NodePointer = std::shared_ptr<const Node>;
+
+    struct Node
+    {
+        Node(std::pair<Key, Value> keyValuePair, NodePointer left, NodePointer right);
+
+        std::pair<Key, Value> keyValuePair;
+        NodePointer left;
+        NodePointer right;
+        std::size_t height;
+    };
+
+    static std::size_t height(const NodePointer& node);
+    static NodePointer makeNode(const std::pair<Key, Value>& keyValuePair, NodePointer left, NodePointer right);
+    static NodePointer balance(const std::pair<Key, Value>& keyValuePair, NodePointer left, NodePointer right);
+
+    static NodePointer join(const NodePointer& left, const std::pair<Key, Value>& keyValuePair,
+                            const NodePointer& right);
+    static NodePointer join(const NodePointer& left, const NodePointer& right);
+    static std::size_t countNodes(const NodePointer& node);
+
+    NodePointer insert(const NodePointer& node, std::pair<Key, Value>&& keyValuePair) const;
+    static NodePointer removeMin(const NodePointer& node, std::pair<Key, Value>& minPair);
+    NodePointer removeEqual(const NodePointer& node, const Key& key, std::size_t& erased) const;
+    NodePointer keepLess(const NodePointer& node, const Key& key, std::size_t& erased) const;
+    NodePointer keepGreater(const NodePointer& node, const Key& key, std::size_t& erased) const;
+
+public:
+    using KeyCompare = Compare;
+
+    PersistentTree() = default;
+    explicit PersistentTree(const Compare& compare);
+    ~PersistentTree() = default;
+
+    PersistentTree(const PersistentTree& other) = default;
+    PersistentTree& operator=(const PersistentTree& other) = default;
+
+    PersistentTree(PersistentTree&& other) noexcept = default;
+    PersistentTree& operator=(PersistentTree&& other) noexcept = default;
+
+    class ConstIterator
+    {
+    public:
+        ConstIterator() = default;
+
+        const std::pair<Key, Value>& operator*() const;
+        const std::pair<Key, Value>* operator->() const;
+
+        ConstIterator operator++();
+        ConstIterator operator++(int);
+
+        ConstIterator operator--();
+        ConstIterator operator--(int);
+
+        bool operator==(const ConstIterator& other) const;
+        bool operator!=(const ConstIterator& other) const;
+
+    private:
+        friend class PersistentTree;
+
+        // Nodes from the root down to the current one; empty at the end.
+        std::vector<const Node*> _path;
+    };
+
+    PersistentTree snapshot() const;
+
+    void insert(const Key& key, const Value& value);
+    void insert(Key&& key, Value&& value);
+
+    std::size_t erase(const Key& key);
+
+    ConstIterator find(const Key& key) const;
+
+    ConstIterator lowerBound(const Key& key) const;
+    ConstIterator upperBound(const Key& key) const;
+
+    std::pair<ConstIterator, ConstIterator> equalRange(const Key& key) const;
+
+    ConstIterator begin() const;
+    ConstIterator end() const;
+
+    ConstIterator cbegin() const;
+    ConstIterator cend() const;
+
+    std::size_t size() const;
+    std::size_t height() const;
+
+    const Compare& keyCompare() const;
+
+private:
+    template<typename Descend>
+    ConstIterator bound(Descend goesLeft) const;
+
+    NodePointer _root;
+    std::size_t _size = 0;
+    Compare _compare;
+};
+
+template<typename Key, typename Value, typename Compare>
+PersistentTree<Key, Value, Compare>::Node::Node(std::pair<Key, Value> keyValuePair, NodePointer left, NodePointer right):
+        keyValuePair(std::move(keyValuePair)), left(std::move(left)), right(std::move(right)),
+        height(1 + std::max(PersistentTree::height(this->left), PersistentTree::height(this->right))) {
+}
+
+template<typename Key, typename Value, typename Compare>
+PersistentTree<Key, Value, Compare>::PersistentTree(const Compare& compare): _compare(compare) {
+}
+
+template<typename Key, typename Value, typename Compare>
+const std::pair<Key, Value>& PersistentTree<Key, Value, Compare>::ConstIterator::operator*() const {
+    return _path.back()->keyValuePair;
+}
+
+template<typename Key, typename Value, typename Compare>
+const std::pair<Key, Value>* PersistentTree<Key, Value, Compare>::ConstIterator::operator->() const {
+    return &_path.back()->keyValuePair;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename PersistentTree<Key, Value, Compare>::ConstIterator PersistentTree<Key, Value, Compare>::ConstIterator::operator++() {
+    if (_path.empty()) {
+        return *this;
+    }
+    if (_path.back()->right != nullptr) {
+        _path.push_back(_path.back()->right.get());
+        while (_path.back()->left != nullptr) {
+            _path.push_back(_path.back()->left.get());
+        }
+        return *this;
+    }
+    const Node* child = _path.back();
+    _path.pop_back();
+    while (!_path.empty() && _path.back()->right.get() == child) {
+        child = _path.back();
+        _path.pop_back();
+    }
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename PersistentTree<Key, Value, Compare>::ConstIterator PersistentTree<Key, Value, Compare>::ConstIterator::operator++(int) {
+    ConstIterator previous = *this;
+    ++(*this);
+    return previous;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename PersistentTree<Key, Value, Compare>::ConstIterator PersistentTree<Key, Value, Compare>::ConstIterator::operator--() {
+    if (_path.empty()) {
+        return *this;
+    }
+    if (_path.back()->left != nullptr) {
+        _path.push_back(_path.back()->left.get());
+        while (_path.back()->right != nullptr) {
+            _path.push_back(_path.back()->right.get());
+        }
+        return *this;
+    }
+    const Node* child = _path.back();
+    _path.pop_back();
+    while (!_path.empty() && _path.back()->left.get() == child) {
+        child = _path.back();
+        _path.pop_back();
+    }
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename PersistentTree<Key, Value, Compare>::ConstIterator PersistentTree<Key, Value, Compare>::ConstIterator::operator--(int) {
+    ConstIterator previous = *this;
+    --(*this);
+    return previous;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool PersistentTree<Key, Value, Compare>::ConstIterator::operator==(const PersistentTree::ConstIterator& other) const {
+    const Node* node = _path.empty() ? nullptr : _path.back();
+    const Node* otherNode = other._path.empty() ? nullptr : other._path.back();
+    return node == otherNode;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool PersistentTree<Key, Value, Compare>::ConstIterator::operator!=(const PersistentTree::ConstIterator& other) const {
+    return !(*this == other);
+}
+
+template<typename Key, typename Value, typename Compare>
+std::size_t PersistentTree<Key, Value, Compare>::height(const NodePointer& node) {
+    return node != nullptr ? node->height : 0;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename PersistentTree<Key, Value, Compare>::NodePointer
+        PersistentTree<Key, Value, Compare>::makeNode(const std::pair<Key, Value>& keyValuePair, NodePointer left, NodePointer right) {
+    return std::make_shared<const Node>(keyValuePair, std::move(left), std::move(right));
+}
+
+// New node for keyValuePair over left and right, rotated as needed when the
+// subtree heights differ by two.
+template<typename Key, typename Value, typename Compare>
+typename PersistentTree<Key, Value, Compare>::NodePointer
+        PersistentTree<Key, Value, Compare>::balance(const std::pair<Key, Value>& keyValuePair, NodePointer left, NodePointer right) {
+    if (height(left) > height(right) + 1) {
+        if (height(left->left) >= height(left->right)) {
+            return makeNode(left->keyValuePair, left->left, makeNode(keyValuePair, left->right, std::move(right)));
+        }
+        const NodePointer& pivot = left->right;
+        return makeNode(pivot->keyValuePair, makeNode(left->keyValuePair, left->left, pivot->left),
+                        makeNode(keyValuePair, pivot->right, std::move(right)));
+    }
+    if (height(right) > height(left) + 1) {
+        if (height(right->right) >= height(right->left)) {
+            return makeNode(right->keyValuePair, makeNode(keyValuePair, std::move(left), right->left), right->right);
+        }
+        const NodePointer& pivot = right->left;
+        return makeNode(pivot->keyValuePair, makeNode(keyValuePair, std::move(left), pivot->left),
+                        makeNode(right->keyValuePair, pivot->right, right->right));
+    }
+    return makeNode(keyValuePair, std::move(left), std::move(right));
+}
+
+template<typename Key, typename Value, typename Compare>
+typename PersistentTree<Key, Value, Compare>::NodePointer
+        PersistentTree<Key, Value, Compare>::insert(const NodePointer& node, std::pair<Key, Value>&& keyValuePair) const {
+    if (node == nullptr) {
+        return std::make_shared<const Node>(std::move(keyValuePair), nullptr, nullptr);
+    }
+    if (!_compare(node->keyValuePair.first, keyValuePair.first)) {
+        return balance(node->keyValuePair, insert(node->left, std::move(keyValuePair)), node->right);
+    }
+    return balance(node->keyValuePair, node->left, insert(node->right, std::move(keyValuePair)));
+}
+
+// Subtree of left, keyValuePair and right, whose heights may differ by any
+// amount; keyValuePair must sort between them.
+template<typename Key, typename Value, typename Compare>
+typename PersistentTree<Key, Value, Compare>::NodePointer
+        PersistentTree<Key, Value, Compare>::join(const NodePointer& left, const std::pair<Key, Value>& keyValuePair,
+                                                 const NodePointer& right) {
+    if (height(left) > height(right) + 1) {
+        return balance(left->keyValuePair, left->left, join(left->right, keyValuePair, right));
+    }
+    if (height(right) > height(left) + 1) {
+        return balance(right->keyValuePair, join(left, keyValuePair, right->left), right->right);
+    }
+    return makeNode(keyValuePair, left, right);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename PersistentTree<Key, Value, Compare>::NodePointer
+        PersistentTree<Key, Value, Compare>::join(const NodePointer& left, const NodePointer& right) {
+    if (right == nullptr) {
+        return left;
+    }
+    std::pair<Key, Value> minPair;
+    NodePointer rest = removeMin(right, minPair);
+    return join(left, minPair, rest);
+}
+
+template<typename Key, typename Value, typename Compare>
+std::size_t PersistentTree<Key, Value, Compare>::countNodes(const NodePointer& node) {
+    return node != nullptr ? 1 + countNodes(node->left) + countNodes(node->right) : 0;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename PersistentTree<Key, Value, Compare>::NodePointer
+        PersistentTree<Key, Value, Compare>::removeMin(const NodePointer& node, std::pair<Key, Value>& minPair) {
+    if (node->left == nullptr) {
+        minPair = node->keyValuePair;
+        return node->right;
+    }
+    return balance(node->keyValuePair, removeMin(node->left, minPair), node->right);
+}
+
+// Subtree without the elements whose key is equivalent to key; node itself
+// when there are none. The run is cut out with joins on the way back up, so
+// only one path is descended however many duplicates there are.
+template<typename Key, typename Value, typename Compare>
+typename PersistentTree<Key, Value, Compare>::NodePointer
+        PersistentTree<Key, Value, Compare>::removeEqual(const NodePointer& node, const Key& key, std::size_t& erased) const {
+    if (node == nullptr) {
+        return node;
+    }
+    if (_compare(key, node->keyValuePair.first)) {
+        NodePointer left = removeEqual(node->left, key, erased);
+        return erased > 0 ? join(left, node->keyValuePair, node->right) : node;
+    }
+    if (_compare(node->keyValuePair.first, key)) {
+        NodePointer right = removeEqual(node->right, key, erased);
+        return erased > 0 ? join(node->left, node->keyValuePair, right) : node;
+    }
+    erased++;
+    NodePointer left = keepLess(node->left, key, erased);
+    return join(left, keepGreater(node->right, key, erased));
+}
+
+// Elements of a subtree with no key greater than key that are less than it;
+// the rest are equivalent to key and are counted in erased.
+template<typename Key, typename Value, typename Compare>
+typename PersistentTree<Key, Value, Compare>::NodePointer
+        PersistentTree<Key, Value, Compare>::keepLess(const NodePointer& node, const Key& key, std::size_t& erased) const {
+    if (node == nullptr) {
+        return node;
+    }
+    if (_compare(node->keyValuePair.first, key)) {
+        std::size_t before = erased;
+        NodePointer right = keepLess(node->right, key, erased);
+        return erased > before ? join(node->left, node->keyValuePair, right) : node;
+    }
+    erased += 1 + countNodes(node->right);
+    return keepLess(node->left, key, erased);
+}
+
+// Mirror of keepLess for a subtree with no key less than key.
+template<typename Key, typename Value, typename Compare>
+typename PersistentTree<Key, Value, Compare>::NodePointer
+        PersistentTree<Key, Value, Compare>::keepGreater(const NodePointer& node, const Key& key, std::size_t& erased) const {
+    if (node == nullptr) {
+        return node;
+    }
+    if (_compare(key, node->keyValuePair.first)) {
+        std::size_t before = erased;
+        NodePointer left = keepGreater(node->left, key, erased);
+        return erased > before ? join(left, node->keyValuePair, node->right) : node;
+    }
+    erased += 1 + countNodes(node->left);
+    return keepGreater(node->right, key, erased);
+}
+
+template<typename Key, typename Value, typename Compare>
+PersistentTree<Key, Value, Compare> PersistentTree<Key, Value, Compare>::snapshot() const {
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare>
+void PersistentTree<Key, Value, Compare>::insert(const Key& key, const Value& value) {
+    _root = insert(_root, std::make_pair(key, value));
+    _size++;
+}
+
+template<typename Key, typename Value, typename Compare>
+void PersistentTree<Key, Value, Compare>::insert(Key&& key, Value&& value) {
+    _root = insert(_root, std::make_pair(std::move(key), std::move(value)));
+    _size++;
+}
+
+template<typename Key, typename Value, typename Compare>
+std::size_t PersistentTree<Key, Value, Compare>::erase(const Key& key) {
+    std::size_t erased = 0;
+    _root = removeEqual(_root, key, erased);
+    _size -= erased;
+    return erased;
+}
+
+// Iterator to the leftmost node for which goesLeft holds.
+template<typename Key, typename Value, typename Compare>
+template<typename Descend>
+typename PersistentTree<Key, Value, Compare>::ConstIterator PersistentTree<Key, Value, Compare>::bound(Descend goesLeft) const {
+    ConstIterator iterator;
+    std::size_t boundDepth = 0;
+    for (const Node* curNode = _root.get(); curNode != nullptr;) {
+        iterator._path.push_back(curNode);
+        if (goesLeft(curNode->keyValuePair.first)) {
+            boundDepth = iterator._path.size();
+            curNode = curNode->left.get();
+        }
+        else {
+            curNode = curNode->right.get();
+        }
+    }
+    iterator._path.resize(boundDepth);
+    return iterator;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename PersistentTree<Key, Value, Compare>::ConstIterator PersistentTree<Key, Value, Compare>::find(const Key& key) const {
+    ConstIterator iterator = lowerBound(key);
+    if (iterator == cend() || _compare(key, iterator->first)) {
+        return cend();
+    }
+    return iterator;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename PersistentTree<Key, Value, Compare>::ConstIterator PersistentTree<Key, Value, Compare>::lowerBound(const Key& key) const {
+    return bound([this, &key](const Key& nodeKey) {
+        return !_compare(nodeKey, key);
+    });
+}
+
+template<typename Key, typename Value, typename Compare>
+typename PersistentTree<Key, Value, Compare>::ConstIterator PersistentTree<Key, Value, Compare>::upperBound(const Key& key) const {
+    return bound([this, &key](const Key& nodeKey) {
+        return _compare(key, nodeKey);
+    });
+}
+
+template<typename Key, typename Value, typename Compare>
+std::pair<typename PersistentTree<Key, Value, Compare>::ConstIterator, typename PersistentTree<Key, Value, Compare>::ConstIterator>
+        PersistentTree<Key, Value, Compare>::equalRange(const Key& key) const {
+    return std::make_pair(lowerBound(key), upperBound(key));
+}
+
+template<typename Key, typename Value, typename Compare>
+typename PersistentTree<Key, Value, Compare>::ConstIterator PersistentTree<Key, Value, Compare>::begin() const {
+    return cbegin();
+}
+
+template<typename Key, typename Value, typename Compare>
+typename PersistentTree<Key, Value, Compare>::ConstIterator PersistentTree<Key, Value, Compare>::end() const {
+    return cend();
+}
+
+template<typename Key, typename Value, typename Compare>
+typename PersistentTree<Key, Value, Compare>::ConstIterator PersistentTree<Key, Value, Compare>::cbegin() const {
+    ConstIterator iterator;
+    for (const Node* curNode = _root.get(); curNode != nullptr; curNode = curNode->left.get()) {
+        iterator._path.push_back(curNode);
+    }
+    return iterator;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename PersistentTree<Key, Value, Compare>::ConstIterator PersistentTree<Key, Value, Compare>::cend() const {
+    return ConstIterator();
+}
+
+template<typename Key, typename Value, typename Compare>
+std::size_t PersistentTree<Key, Value, Compare>::size() const {
+    return _size;
+}
+
+template<typename Key, typename Value, typename Compare>
+std::size_t PersistentTree<Key, Value, Compare>::height() const {
+    return height(_root);
+}
+
+template<typename Key, typename Value, typename Compare>
+const Compare& PersistentTree<Key, Value, Compare>::keyCompare() const {
+    return _compare;
+}
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <typeindex>
+#include <utility>
+#include <vector>
+
+// Pools shared by PoolAllocators rebound from one another, one per element
+// type.
+struct PoolArena
+{
+    std::vector<std::pair<std::type_index, std::shared_ptr<void>>> pools;
+};
+
+// Allocator that hands out single objects from contiguous chunks and keeps
+// a free list of released slots. Copies and rebound allocators share one
+// arena, so A(B(a)) == a, while default and container copy construction
+// start a new one. Trees built from copies of one allocator thus compare
+// equal, and split, join and merge relink their nodes instead of copying.
+template <typename T, std::size_t ChunkSize = 256>
+class PoolAllocator
+{
+    union Slot
+    {
+        Slot* next;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    struct Pool
+    {
+        std::vector<std::unique_ptr<Slot[]>> chunks;
+        Slot* freeList = nullptr;
+        std::size_t used = 0;
+        std::size_t capacity = 0;
+    };
+
+    template <typename U, std::size_t Size>
+    friend class PoolAllocator;
+
+    static Pool* poolIn(PoolArena& arena);
+
+    std::shared_ptr<PoolArena> _arena;
+    Pool* _pool;
+
+public:
+    using value_type = T;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    template <typename U>
+    struct rebind
+    {
+        using other = PoolAllocator<U, ChunkSize>;
+    };
+
+    PoolAllocator();
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U, ChunkSize>& other);
+
+    T* allocate(std::size_t n);
+    void deallocate(T* pointer, std::size_t n);
+
+    // Makes the next n single-object allocations come from one contiguous chunk.
+    void reserve(std::size_t n);
+
+    // Drops every chunk of this type's pool at once and returns true, or
+    // returns false when another allocator shares the arena and may still
+    // own objects in it. Objects still living in the pool are not destroyed,
+    // so this is only valid for trivially destructible T.
+    bool release();
+
+    PoolAllocator select_on_container_copy_construction() const;
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U, ChunkSize>& other) const;
+    template <typename U>
+    bool operator!=(const PoolAllocator<U, ChunkSize>& other) const;
+};
+
+// Pool for T in arena, created on first use.
+template<typename T, std::size_t ChunkSize>
+typename PoolAllocator<T, ChunkSize>::Pool* PoolAllocator<T, ChunkSize>::poolIn(PoolArena& arena) {
+    std::type_index type(typeid(T));
+    for (auto& entry : arena.pools) {
+        if (entry.first == type) {
+            return static_cast<Pool*>(entry.second.get());
+        }
+    }
+    auto pool = std::make_shared<Pool>();
+    arena.pools.emplace_back(type, pool);
+    return pool.get();
+}
+
+template<typename T, std::size_t ChunkSize>
+PoolAllocator<T, ChunkSize>::PoolAllocator(): _arena(std::make_shared<PoolArena>()), _pool(poolIn(*_arena)) {
+}
+
+template<typename T, std::size_t ChunkSize>
+template<typename U>
+PoolAllocator<T, ChunkSize>::PoolAllocator(const PoolAllocator<U, ChunkSize>& other):
+        _arena(other._arena), _pool(poolIn(*_arena)) {
+}
+
+template<typename T, std::size_t ChunkSize>
+T* PoolAllocator<T, ChunkSize>::allocate(std::size_t n) {
+    if (n != 1) {
+        return std::allocator<T>().allocate(n);
+    }
+    Slot* slot;
+    if (_pool->freeList != nullptr) {
+        slot = _pool->freeList;
+        _pool->freeList = slot->next;
+    }
+    else {
+        if (_pool->used == _pool->capacity) {
+            reserve(ChunkSize);
+        }
+        slot = &_pool->chunks.back()[_pool->used++];
+    }
+    return reinterpret_cast<T*>(slot->storage);
+}
+
+template<typename T, std::size_t ChunkSize>
+void PoolAllocator<T, ChunkSize>::deallocate(T* pointer, std::size_t n) {
+    if (n != 1) {
+        std::allocator<T>().deallocate(pointer, n);
+        return;
+    }
+    Slot* slot = reinterpret_cast<Slot*>(pointer);
+    slot->next = _pool->freeList;
+    _pool->freeList = slot;
+}
+
+template<typename T, std::size_t ChunkSize>
+void PoolAllocator<T, ChunkSize>::reserve(std::size_t n) {
+    if (_pool->capacity - _pool->used < n) {
+        std::size_t capacity = std::max(n, ChunkSize);
+        _pool->chunks.emplace_back(new Slot[capacity]);
+        _pool->used = 0;
+        _pool->capacity = capacity;
+    }
+}
+
+template<typename T, std::size_t ChunkSize>
+bool PoolAllocator<T, ChunkSize>::release() {
+    if (_arena.use_count() > 1) {
+        return false;
+    }
+    _pool->chunks.clear();
+    _pool->freeList = nullptr;
+    _pool->used = 0;
+    _pool->capacity = 0;
+    return true;
+}
+
+template<typename T, std::size_t ChunkSize>
+PoolAllocator<T, ChunkSize> PoolAllocator<T, ChunkSize>::select_on_container_copy_construction() const {
+    return PoolAllocator();
+}
+
+template<typename T, std::size_t ChunkSize>
+template<typename U>
+bool PoolAllocator<T, ChunkSize>::operator==(const PoolAllocator<U, ChunkSize>& other) const {
+    return _arena == other._arena;
+}
+
+template<typename T, std::size_t ChunkSize>
+template<typename U>
+bool PoolAllocator<T, ChunkSize>::operator!=(const PoolAllocator<U, ChunkSize>& other) const {
+    return _arena != other._arena;
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+// Binary layout shared by save/load and MappedMap: a SerializedHeader, then
+// count keys in order, then their count values. Each array starts at an
+// offset aligned for its type, so a mapped file can be read in place.
+// Numbers are stored in host byte order; byteOrder rejects foreign files.
+struct SerializedHeader
+{
+    char magic[8];
+    std::uint32_t byteOrder;
+    std::uint32_t keySize;
+    std::uint32_t valueSize;
+    std::uint32_t reserved;
+    std::uint64_t count;
+};
+
+constexpr char serializedMagic[8] = {'B', 'S', 'T', 'T', 'R', 'E', 'E', '1'};
+constexpr std::uint32_t serializedByteOrder = 0x01020304;
+
+template <typename Key, typename Value>
+struct SerializedLayout
+{
+    static_assert(std::is_trivially_copyable_v<Key> && std::is_trivially_copyable_v<Value>,
+                  "Only trivially copyable keys and values can be serialized");
+
+    static SerializedHeader header(std::uint64_t count);
+    // Throws std::runtime_error unless header describes Key and Value.
+    static void check(const SerializedHeader& header);
+    // Throws std::runtime_error when the offsets for count elements would
+    // overflow, which only a corrupt header can ask for.
+    static void checkCount(std::uint64_t count);
+    // The most elements whose arrays fit in a file of length bytes.
+    static std::uint64_t maxCount(std::size_t length);
+
+    // valuesOffset and fileSize run checkCount first.
+    static std::size_t keysOffset();
+    static std::size_t valuesOffset(std::size_t count);
+    static std::size_t fileSize(std::size_t count);
+
+    static void writePadding(std::ostream& out, std::size_t from, std::size_t to);
+    static void skipPadding(std::istream& in, std::size_t from, std::size_t to);
+    // Reads count items into items in bounded chunks, so a count larger than
+    // the stream fails on the short read instead of allocating for it up
+    // front. Throws std::runtime_error when the stream ends early.
+    template<typename T>
+    static void readArray(std::istream& in, std::vector<T>& items, std::size_t count);
+};
+
+inline std::size_t alignedOffset(std::size_t offset, std::size_t alignment) {
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+template<typename Key, typename Value>
+SerializedHeader SerializedLayout<Key, Value>::header(std::uint64_t count) {
+    SerializedHeader header{};
+    std::memcpy(header.magic, serializedMagic, sizeof(serializedMagic));
+    header.byteOrder = serializedByteOrder;
+    header.keySize = sizeof(Key);
+    header.valueSize = sizeof(Value);
+    header.count = count;
+    return header;
+}
+
+template<typename Key, typename Value>
+void SerializedLayout<Key, Value>::check(const SerializedHeader& header) {
+    if (std::memcmp(header.magic, serializedMagic, sizeof(serializedMagic)) != 0) {
+        throw std::runtime_error("Not a serialized tree!");
+    }
+    if (header.byteOrder != serializedByteOrder) {
+        throw std::runtime_error("Serialized tree has a different byte order!");
+    }
+    if (header.keySize != sizeof(Key) || header.valueSize != sizeof(Value)) {
+        throw std::runtime_error("Serialized tree has different key or value types!");
+    }
+}
+
+template<typename Key, typename Value>
+void SerializedLayout<Key, Value>::checkCount(std::uint64_t count) {
+    std::size_t limit = (std::numeric_limits<std::size_t>::max() - keysOffset() - alignof(Value)) /
+                        (sizeof(Key) + sizeof(Value));
+    if (count > limit) {
+        throw std::runtime_error("Serialized tree is too large!");
+    }
+}
+
+template<typename Key, typename Value>
+std::uint64_t SerializedLayout<Key, Value>::maxCount(std::size_t length) {
+    return length < keysOffset() ? 0 : (length - keysOffset()) / (sizeof(Key) + sizeof(Value));
+}
+
+template<typename Key, typename Value>
+std::size_t SerializedLayout<Key, Value>::keysOffset() {
+    return alignedOffset(sizeof(SerializedHeader), alignof(Key));
+}
+
+template<typename Key, typename Value>
+std::size_t SerializedLayout<Key, Value>::valuesOffset(std::size_t count) {
+    checkCount(count);
+    return alignedOffset(keysOffset() + count * sizeof(Key), alignof(Value));
+}
+
+template<typename Key, typename Value>
+std::size_t SerializedLayout<Key, Value>::fileSize(std::size_t count) {
+    return valuesOffset(count) + count * sizeof(Value);
+}
+
+template<typename Key, typename Value>
+void SerializedLayout<Key, Value>::writePadding(std::ostream& out, std::size_t from, std::size_t to) {
+    for (; from < to; from++) {
+        out.put('\0');
+    }
+}
+
+template<typename Key, typename Value>
+void SerializedLayout<Key, Value>::skipPadding(std::istream& in, std::size_t from, std::size_t to) {
+    in.ignore(static_cast<std::streamsize>(to - from));
+}
+
+template<typename Key, typename Value>
+template<typename T>
+void SerializedLayout<Key, Value>::readArray(std::istream& in, std::vector<T>& items, std::size_t count) {
+    constexpr std::size_t chunk = 65536;
+    items.clear();
+    while (items.size() < count) {
+        std::size_t offset = items.size();
+        std::size_t length = std::min(chunk, count - offset);
+        items.resize(offset + length);
+        if (!in.read(reinterpret_cast<char*>(items.data() + offset), static_cast<std::streamsize>(length * sizeof(T)))) {
+            throw std::runtime_error("Failed to read tree!");
+        }
+    }
+}
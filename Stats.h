@@ -0,0 +1,186 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// Instrumentation policies for BinarySearchTree. NoStats turns every hook
+// into dead code and, as an empty base, adds nothing to the tree's size.
+// TreeStats records into relaxed atomics, so readers holding a shared lock
+// can record concurrently.
+
+enum class TreeOperation
+{
+    Insert,
+    Find,
+    Erase,
+    Bound,
+};
+
+constexpr std::size_t treeOperationCount = 4;
+// Latency bucket i counts operations that took [2^i, 2^(i+1)) nanoseconds.
+constexpr std::size_t latencyBuckets = 32;
+// Depth bucket i counts descents that visited i nodes.
+constexpr std::size_t depthBuckets = 64;
+
+// Plain copy of the counters, indexed by TreeOperation where per operation.
+struct StatsSnapshot
+{
+    // Batch calls and erase(first, last) count as one operation each.
+    std::array<std::uint64_t, treeOperationCount> operations{};
+    std::array<std::array<std::uint64_t, latencyBuckets>, treeOperationCount> latency{};
+    std::array<std::uint64_t, depthBuckets> depth{};
+    std::uint64_t comparisons = 0;
+    std::uint64_t nodeVisits = 0;
+    std::uint64_t allocations = 0;
+    std::uint64_t deallocations = 0;
+    // Elements removed by erase(key) beyond the first one per call.
+    std::uint64_t duplicateErasures = 0;
+};
+
+struct NoStats
+{
+    static constexpr bool enabled = false;
+};
+
+class TreeStats
+{
+public:
+    static constexpr bool enabled = true;
+
+    void recordOperation(TreeOperation operation, std::chrono::nanoseconds elapsed) const;
+    void recordDescent(std::size_t visits, std::size_t comparisons) const;
+    void recordAllocation() const;
+    void recordDeallocation() const;
+    // For nodes freed at once, such as a pool released by clear().
+    void recordDeallocations(std::size_t count) const;
+    void recordDuplicateErasures(std::size_t count) const;
+
+    StatsSnapshot snapshot() const;
+    void reset();
+
+private:
+    using Counter = std::atomic<std::uint64_t>;
+
+    static void add(Counter& counter, std::uint64_t amount);
+
+    mutable std::array<Counter, treeOperationCount> _operations{};
+    mutable std::array<std::array<Counter, latencyBuckets>, treeOperationCount> _latency{};
+    mutable std::array<Counter, depthBuckets> _depth{};
+    mutable Counter _comparisons{0};
+    mutable Counter _nodeVisits{0};
+    mutable Counter _allocations{0};
+    mutable Counter _deallocations{0};
+    mutable Counter _duplicateErasures{0};
+};
+
+// Times one operation from construction to destruction. Empty when Stats
+// is disabled, so the clock is never read.
+template <typename Stats, bool Enabled = Stats::enabled>
+class OperationScope
+{
+public:
+    OperationScope(const Stats& stats, TreeOperation operation);
+};
+
+template <typename Stats>
+class OperationScope<Stats, true>
+{
+public:
+    OperationScope(const Stats& stats, TreeOperation operation);
+    ~OperationScope();
+
+    OperationScope(const OperationScope& other) = delete;
+    OperationScope& operator=(const OperationScope& other) = delete;
+
+private:
+    const Stats& _stats;
+    TreeOperation _operation;
+    std::chrono::steady_clock::time_point _start;
+};
+
+inline void TreeStats::add(Counter& counter, std::uint64_t amount) {
+    counter.fetch_add(amount, std::memory_order_relaxed);
+}
+
+inline void TreeStats::recordOperation(TreeOperation operation, std::chrono::nanoseconds elapsed) const {
+    std::size_t index = static_cast<std::size_t>(operation);
+    std::uint64_t nanoseconds = elapsed.count() > 0 ? elapsed.count() : 1;
+    std::size_t bucket = 63 - __builtin_clzll(nanoseconds);
+    add(_operations[index], 1);
+    add(_latency[index][bucket < latencyBuckets ? bucket : latencyBuckets - 1], 1);
+}
+
+inline void TreeStats::recordDescent(std::size_t visits, std::size_t comparisons) const {
+    add(_depth[visits < depthBuckets ? visits : depthBuckets - 1], 1);
+    add(_nodeVisits, visits);
+    add(_comparisons, comparisons);
+}
+
+inline void TreeStats::recordAllocation() const {
+    add(_allocations, 1);
+}
+
+inline void TreeStats::recordDeallocation() const {
+    add(_deallocations, 1);
+}
+
+inline void TreeStats::recordDeallocations(std::size_t count) const {
+    add(_deallocations, count);
+}
+
+inline void TreeStats::recordDuplicateErasures(std::size_t count) const {
+    add(_duplicateErasures, count);
+}
+
+inline StatsSnapshot TreeStats::snapshot() const {
+    StatsSnapshot snapshot;
+    for (std::size_t operation = 0; operation < treeOperationCount; operation++) {
+        snapshot.operations[operation] = _operations[operation].load(std::memory_order_relaxed);
+        for (std::size_t bucket = 0; bucket < latencyBuckets; bucket++) {
+            snapshot.latency[operation][bucket] = _latency[operation][bucket].load(std::memory_order_relaxed);
+        }
+    }
+    for (std::size_t bucket = 0; bucket < depthBuckets; bucket++) {
+        snapshot.depth[bucket] = _depth[bucket].load(std::memory_order_relaxed);
+    }
+    snapshot.comparisons = _comparisons.load(std::memory_order_relaxed);
+    snapshot.nodeVisits = _nodeVisits.load(std::memory_order_relaxed);
+    snapshot.allocations = _allocations.load(std::memory_order_relaxed);
+    snapshot.deallocations = _deallocations.load(std::memory_order_relaxed);
+    snapshot.duplicateErasures = _duplicateErasures.load(std::memory_order_relaxed);
+    return snapshot;
+}
+
+inline void TreeStats::reset() {
+    for (std::size_t operation = 0; operation < treeOperationCount; operation++) {
+        _operations[operation].store(0, std::memory_order_relaxed);
+        for (Counter& counter : _latency[operation]) {
+            counter.store(0, std::memory_order_relaxed);
+        }
+    }
+    for (Counter& counter : _depth) {
+        counter.store(0, std::memory_order_relaxed);
+    }
+    _comparisons.store(0, std::memory_order_relaxed);
+    _nodeVisits.store(0, std::memory_order_relaxed);
+    _allocations.store(0, std::memory_order_relaxed);
+    _deallocations.store(0, std::memory_order_relaxed);
+    _duplicateErasures.store(0, std::memory_order_relaxed);
+}
+
+template<typename Stats, bool Enabled>
+OperationScope<Stats, Enabled>::OperationScope(const Stats&, TreeOperation) {
+}
+
+template<typename Stats>
+OperationScope<Stats, true>::OperationScope(const Stats& stats, TreeOperation operation):
+        _stats(stats), _operation(operation), _start(std::chrono::steady_clock::now()) {
+}
+
+template<typename Stats>
+OperationScope<Stats, true>::~OperationScope() {
+    _stats.recordOperation(_operation, std::chrono::steady_clock::now() - _start);
+}
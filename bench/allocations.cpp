@@ -0,0 +1,83 @@
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+#include "../BinarySearchTree.h"
+
+static std::size_t allocations = 0;
+
+void* operator new(std::size_t size) {
+    allocations++;
+    if (void* pointer = std::malloc(size)) {
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept {
+    std::free(pointer);
+}
+
+using Tree = BinarySearchTree<std::string, std::string>;
+using PooledTree = BinarySearchTree<std::string, std::string, AvlBalance, PoolAllocator<std::string>>;
+
+static const std::size_t count = 100000;
+
+// Keys and values are longer than the small string buffer, so every string
+// copy costs a heap allocation.
+static std::vector<std::string> makeStrings(const std::string& prefix) {
+    std::vector<std::string> strings;
+    strings.reserve(count);
+    for (std::size_t i = 0; i < count; i++) {
+        strings.push_back(prefix + "-long-enough-to-defeat-sso-" + std::to_string(i * 7919 % count));
+    }
+    return strings;
+}
+
+template<typename Insert>
+static void report(const std::string& name, Insert insert) {
+    std::vector<std::string> keys = makeStrings("key");
+    std::vector<std::string> values = makeStrings("value");
+    std::size_t before = allocations;
+    insert(keys, values);
+    std::cout << name << ": " << double(allocations - before) / count << " allocations per insert" << std::endl;
+}
+
+int main() {
+    report("insert(const Key&, const Value&)", [](auto& keys, auto& values) {
+        Tree tree;
+        for (std::size_t i = 0; i < count; i++) {
+            tree.insert(keys[i], values[i]);
+        }
+    });
+    report("insert(Key&&, Value&&)", [](auto& keys, auto& values) {
+        Tree tree;
+        for (std::size_t i = 0; i < count; i++) {
+            tree.insert(std::move(keys[i]), std::move(values[i]));
+        }
+    });
+    report("emplace(Key&&, Value&&)", [](auto& keys, auto& values) {
+        Tree tree;
+        for (std::size_t i = 0; i < count; i++) {
+            tree.emplace(std::move(keys[i]), std::move(values[i]));
+        }
+    });
+    report("tryEmplace(Key&&, Value&&)", [](auto& keys, auto& values) {
+        Tree tree;
+        for (std::size_t i = 0; i < count; i++) {
+            tree.tryEmplace(std::move(keys[i]), std::move(values[i]));
+        }
+    });
+    report("insert(Key&&, Value&&) with PoolAllocator", [](auto& keys, auto& values) {
+        PooledTree tree;
+        for (std::size_t i = 0; i < count; i++) {
+            tree.insert(std::move(keys[i]), std::move(values[i]));
+        }
+    });
+    return 0;
+}
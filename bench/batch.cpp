@@ -0,0 +1,74 @@
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+#include "../BinarySearchTree.h"
+
+using Tree = BinarySearchTree<int, int>;
+
+template<typename Function>
+static double seconds(Function function) {
+    auto start = std::chrono::steady_clock::now();
+    function();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+static void report(const std::string& name, std::size_t count, double loopSeconds, double batchSeconds) {
+    std::cout << name << ": loop " << count / loopSeconds / 1e6 << " M/s, batch "
+              << count / batchSeconds / 1e6 << " M/s, speedup " << loopSeconds / batchSeconds << "x" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    std::size_t count = argc > 1 ? std::stoul(argv[1]) : 1000000;
+    std::mt19937 generator(42);
+    std::vector<std::pair<int, int>> keyValuePairs(count);
+    for (auto& keyValuePair : keyValuePairs) {
+        keyValuePair.first = static_cast<int>(generator());
+        keyValuePair.second = keyValuePair.first;
+    }
+    std::vector<int> lookups(count);
+    for (std::size_t i = 0; i < count; i++) {
+        lookups[i] = i % 2 == 0 ? keyValuePairs[generator() % count].first : static_cast<int>(generator());
+    }
+
+    std::cout << count << " random int keys, " << workerCount() << " workers" << std::endl;
+
+    Tree looped;
+    double loopInsert = seconds([&] {
+        for (const auto& keyValuePair : keyValuePairs) {
+            looped.insert(keyValuePair.first, keyValuePair.second);
+        }
+    });
+    Tree batched;
+    double batchInsert = seconds([&] {
+        batched.insertBatch(keyValuePairs);
+    });
+    report("insert", count, loopInsert, batchInsert);
+
+    const Tree& tree = looped;
+    long long loopChecksum = 0;
+    double loopFind = seconds([&] {
+        for (int key : lookups) {
+            Tree::ConstIterator iterator = tree.find(key);
+            if (iterator != tree.cend()) {
+                loopChecksum += iterator->second;
+            }
+        }
+    });
+    long long batchChecksum = 0;
+    std::vector<Tree::ConstIterator> found;
+    double batchFind = seconds([&] {
+        tree.findBatch(lookups, found);
+        for (const Tree::ConstIterator& iterator : found) {
+            if (iterator != tree.cend()) {
+                batchChecksum += iterator->second;
+            }
+        }
+    });
+    report("find", count, loopFind, batchFind);
+    std::cout << "checksums " << loopChecksum << " " << batchChecksum << std::endl;
+    return 0;
+}
@@ -0,0 +1,71 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+#include "../BinarySearchTree.h"
+#include "../BTree.h"
+
+static std::size_t allocatedBytes = 0;
+
+void* operator new(std::size_t size) {
+    allocatedBytes += size;
+    if (void* pointer = std::malloc(size)) {
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept {
+    std::free(pointer);
+}
+
+template<typename Tree>
+static void run(const std::string& name, const std::vector<int>& keys, const std::vector<int>& lookups) {
+    std::size_t before = allocatedBytes;
+    Tree tree;
+    for (int key : keys) {
+        tree.insert(key, key);
+    }
+    double bytesPerEntry = double(allocatedBytes - before) / keys.size();
+
+    auto start = std::chrono::steady_clock::now();
+    long long checksum = 0;
+    for (int key : lookups) {
+        auto iterator = tree.find(key);
+        if (iterator != tree.end()) {
+            checksum += iterator->second;
+        }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::cout << name << ": " << lookups.size() / elapsed.count() / 1e6 << " M lookups/s, "
+              << bytesPerEntry << " bytes/entry, height " << tree.height()
+              << " (checksum " << checksum << ")" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    std::size_t count = argc > 1 ? std::stoul(argv[1]) : 1000000;
+    std::mt19937 generator(42);
+    std::vector<int> keys(count);
+    for (int& key : keys) {
+        key = static_cast<int>(generator());
+    }
+    std::vector<int> lookups(count);
+    for (std::size_t i = 0; i < count; i++) {
+        lookups[i] = i % 2 == 0 ? keys[generator() % count] : static_cast<int>(generator());
+    }
+
+    std::cout << count << " random int keys" << std::endl;
+    run<BinarySearchTree<int, int>>("BinarySearchTree", keys, lookups);
+    run<BTree<int, int, 16>>("BTree<16>", keys, lookups);
+    run<BTree<int, int, 32>>("BTree<32>", keys, lookups);
+    run<BTree<int, int, 64>>("BTree<64>", keys, lookups);
+    return 0;
+}
@@ -0,0 +1,64 @@
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../BTree.h"
+#include "../ConcurrentSet.h"
+
+static const std::size_t keyRange = 1 << 20;
+static const std::size_t operationsPerThread = 1 << 20;
+
+// 95% contains, 5% insert/erase, uniformly random keys.
+template<typename SetType>
+static double run(SetType& set, std::size_t threadCount) {
+    std::atomic<std::size_t> hits = 0;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < threadCount; t++) {
+        threads.emplace_back([&set, &hits, t] {
+            std::mt19937 generator(t);
+            std::size_t localHits = 0;
+            for (std::size_t i = 0; i < operationsPerThread; i++) {
+                int key = static_cast<int>(generator() % keyRange);
+                unsigned operation = generator() % 100;
+                if (operation < 95) {
+                    localHits += set.contains(key);
+                }
+                else if (operation < 98) {
+                    set.insert(key);
+                }
+                else {
+                    set.erase(key);
+                }
+            }
+            hits += localHits;
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return threadCount * operationsPerThread / elapsed.count() / 1e6;
+}
+
+template<typename SetType>
+static void report(const std::string& name, std::size_t maxThreads) {
+    for (std::size_t threads = 1; threads <= maxThreads; threads *= 2) {
+        SetType set;
+        for (std::size_t key = 0; key < keyRange; key += 2) {
+            set.insert(static_cast<int>(key));
+        }
+        std::cout << name << ", " << threads << " threads: " << run(set, threads) << " M ops/s" << std::endl;
+    }
+}
+
+int main(int argc, char** argv) {
+    std::size_t maxThreads = argc > 1 ? std::stoul(argv[1]) : std::max(1u, std::thread::hardware_concurrency());
+    report<ConcurrentSet<int, BinarySearchTree<int, int>, 1>>("single lock", maxThreads);
+    report<ConcurrentSet<int, BinarySearchTree<int, int>, 64>>("64 shards", maxThreads);
+    report<ConcurrentSet<int, BTree<int, int>, 64>>("64 shards, BTree", maxThreads);
+    return 0;
+}
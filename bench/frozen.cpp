@@ -0,0 +1,90 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "../BinarySearchTree.h"
+#include "../FrozenTree.h"
+
+// Lookup latency of BinarySearchTree against its frozen Eytzinger copy, for
+// sizes up to well past the last level cache.
+// Usage: BST_frozen_bench [sizes, default 100000,1000000,10000000]
+
+using Key = std::uint64_t;
+using Tree = BinarySearchTree<Key, Key>;
+
+template<typename Function>
+static double seconds(Function function) {
+    auto start = std::chrono::steady_clock::now();
+    function();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+// Nanoseconds per call of lookup over keys, plus a checksum so the calls
+// cannot be dropped.
+template<typename Lookup>
+static std::pair<double, Key> measure(const std::vector<Key>& keys, Lookup lookup) {
+    Key checksum = 0;
+    double elapsed = seconds([&] {
+        for (Key key : keys) {
+            checksum += lookup(key);
+        }
+    });
+    return {elapsed * 1e9 / keys.size(), checksum};
+}
+
+static void report(const std::string& name, std::pair<double, Key> tree, std::pair<double, Key> frozen) {
+    std::cout << "  " << name << ": tree " << tree.first << " ns, frozen " << frozen.first << " ns, speedup "
+              << tree.first / frozen.first << "x" << (tree.second == frozen.second ? "" : " MISMATCH") << std::endl;
+}
+
+int main(int argc, char** argv) {
+    std::stringstream sizes(argc > 1 ? argv[1] : "100000,1000000,10000000");
+    std::string sizeText;
+    while (std::getline(sizes, sizeText, ',')) {
+        std::size_t size = std::stoul(sizeText);
+        std::mt19937_64 generator(42);
+        std::vector<std::pair<Key, Key>> entries(size);
+        for (auto& entry : entries) {
+            entry.first = generator();
+            entry.second = entry.first;
+        }
+        std::vector<Key> lookups(std::min<std::size_t>(size, 1000000));
+        for (std::size_t i = 0; i < lookups.size(); i++) {
+            lookups[i] = i % 2 == 0 ? entries[generator() % size].first : generator();
+        }
+
+        Tree tree;
+        tree.insertBatch(entries);
+        FrozenTree<Key, Key> frozen = tree.freeze();
+        std::cout << size << " random keys" << std::endl;
+
+        report("find", measure(lookups, [&](Key key) {
+            Tree::ConstIterator iterator = static_cast<const Tree&>(tree).find(key);
+            return iterator != tree.cend() ? iterator->second : 0;
+        }), measure(lookups, [&](Key key) {
+            auto iterator = frozen.find(key);
+            return iterator != frozen.cend() ? iterator->second : 0;
+        }));
+        report("lowerBound", measure(lookups, [&](Key key) {
+            Tree::ConstIterator iterator = static_cast<const Tree&>(tree).lowerBound(key);
+            return iterator != tree.cend() ? iterator->first : 0;
+        }), measure(lookups, [&](Key key) {
+            auto iterator = frozen.lowerBound(key);
+            return iterator != frozen.cend() ? iterator->first : 0;
+        }));
+        report("equalRange", measure(lookups, [&](Key key) {
+            auto range = static_cast<const Tree&>(tree).equalRange(key);
+            return static_cast<Key>(range.first != range.second);
+        }), measure(lookups, [&](Key key) {
+            auto range = frozen.equalRange(key);
+            return static_cast<Key>(range.first != range.second);
+        }));
+    }
+    return 0;
+}
@@ -0,0 +1,424 @@
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../CompactTree.h"
+#include "../set.h"
+
+// Repeatable workloads for BinarySearchTree, Map and Set next to the
+// matching standard containers. Every (container, keys, size) run happens in
+// a child process, so peak RSS belongs to that run alone. Each workload
+// prints one JSON object per line:
+//   {"container", "keys", "size", "workload", "operations", "ops_per_sec",
+//    "p50_ns", "p99_ns", "p999_ns", "peak_rss_kb"}
+// iterate and copy (assignment to a second container) are one full pass
+// each, so they report elements per second and zero percentiles.
+// Usage: BST_bench [sizes, default 1000,100000,1000000] [containers] [key kinds]
+// where the lists are comma separated; --help lists the accepted values.
+
+using Key = std::uint64_t;
+
+// Keeps results alive so lookups are not optimised away.
+static volatile Key sink;
+
+static Key scramble(Key value) {
+    value += 0x9e3779b97f4a7c15ULL;
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+    return value ^ (value >> 31);
+}
+
+// Zipf ranks in [1, count] with exponent 0.99, drawn by rejection-inversion
+// (Hörmann and Derflinger) in O(1) memory, so 100M-key runs need no table.
+class ZipfGenerator
+{
+public:
+    ZipfGenerator(std::size_t count, double exponent = 0.99);
+    std::size_t operator()(std::mt19937_64& generator);
+
+private:
+    double h(double x) const;
+    double hIntegral(double x) const;
+    double hIntegralInverse(double x) const;
+
+    double _count;
+    double _exponent;
+    double _hIntegralX1;
+    double _hIntegralN;
+    double _threshold;
+};
+
+ZipfGenerator::ZipfGenerator(std::size_t count, double exponent): _count(count), _exponent(exponent) {
+    _hIntegralX1 = hIntegral(1.5) - 1;
+    _hIntegralN = hIntegral(_count + 0.5);
+    _threshold = 2 - hIntegralInverse(hIntegral(2.5) - h(2));
+}
+
+std::size_t ZipfGenerator::operator()(std::mt19937_64& generator) {
+    std::uniform_real_distribution<double> uniform(0, 1);
+    while (true) {
+        double u = _hIntegralN + uniform(generator) * (_hIntegralX1 - _hIntegralN);
+        double x = hIntegralInverse(u);
+        double rank = std::min(std::max(std::floor(x + 0.5), 1.0), _count);
+        if (rank - x <= _threshold || u >= hIntegral(rank + 0.5) - h(rank)) {
+            return static_cast<std::size_t>(rank);
+        }
+    }
+}
+
+double ZipfGenerator::h(double x) const {
+    return std::exp(-_exponent * std::log(x));
+}
+
+double ZipfGenerator::hIntegral(double x) const {
+    double logX = std::log(x);
+    double t = (1 - _exponent) * logX;
+    return (std::abs(t) > 1e-8 ? std::expm1(t) / t : 1 + t / 2) * logX;
+}
+
+double ZipfGenerator::hIntegralInverse(double x) const {
+    double t = x * (1 - _exponent);
+    t = std::max(t, -1.0 + 1e-12);
+    return std::exp((std::abs(t) > 1e-8 ? std::log1p(t) / t : 1 - t / 2) * x);
+}
+
+static std::vector<Key> makeKeys(const std::string& kind, std::size_t count, std::uint64_t seed) {
+    std::mt19937_64 generator(seed);
+    std::vector<Key> keys(count);
+    if (kind == "sorted") {
+        for (std::size_t i = 0; i < count; i++) {
+            keys[i] = i;
+        }
+    }
+    else if (kind == "zipf") {
+        ZipfGenerator zipf(count);
+        for (Key& key : keys) {
+            key = scramble(zipf(generator));
+        }
+    }
+    else if (kind == "duplicates") {
+        // About a hundred copies of every key.
+        std::size_t distinct = std::max<std::size_t>(1, count / 100);
+        for (Key& key : keys) {
+            key = scramble(generator() % distinct);
+        }
+    }
+    else {
+        for (Key& key : keys) {
+            key = generator();
+        }
+    }
+    return keys;
+}
+
+// Uniform operations over the containers under test.
+template<typename Container>
+static void insertKey(Container& container, Key key) {
+    container.insert(key, key);
+}
+
+static void insertKey(std::multimap<Key, Key>& container, Key key) {
+    container.emplace(key, key);
+}
+
+static void insertKey(std::map<Key, Key>& container, Key key) {
+    container.insert_or_assign(key, key);
+}
+
+template<typename Tree>
+static void insertKey(Set<Key, Tree>& container, Key key) {
+    container.insert(key);
+}
+
+static void insertKey(std::set<Key>& container, Key key) {
+    container.insert(key);
+}
+
+template<typename Container>
+static bool findKey(const Container& container, Key key) {
+    return container.find(key) != container.cend();
+}
+
+template<typename Tree>
+static bool findKey(const Set<Key, Tree>& container, Key key) {
+    return container.contains(key);
+}
+
+static Key keyOf(Key key) {
+    return key;
+}
+
+template<typename Pair>
+static Key keyOf(const Pair& keyValuePair) {
+    return keyValuePair.first;
+}
+
+template<typename Container>
+static Key sumKeys(const Container& container) {
+    Key sum = 0;
+    for (auto iter = container.cbegin(); iter != container.cend(); ++iter) {
+        sum += keyOf(*iter);
+    }
+    return sum;
+}
+
+struct Measurement
+{
+    std::size_t operations = 0;
+    double seconds = 0;
+    std::vector<std::uint64_t> latencies;
+};
+
+// Runs operation(i) for every i in [0, count) and times every stride-th call,
+// keeping at most about a million latency samples.
+template<typename Operation>
+static Measurement measure(std::size_t count, Operation operation) {
+    Measurement measurement;
+    measurement.operations = count;
+    std::size_t stride = std::max<std::size_t>(1, count / 1000000);
+    measurement.latencies.reserve(count / stride + 1);
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < count; i++) {
+        if (i % stride == 0) {
+            auto operationStart = std::chrono::steady_clock::now();
+            operation(i);
+            auto elapsed = std::chrono::steady_clock::now() - operationStart;
+            measurement.latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+        }
+        else {
+            operation(i);
+        }
+    }
+    measurement.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return measurement;
+}
+
+static std::uint64_t percentile(std::vector<std::uint64_t>& latencies, double fraction) {
+    if (latencies.empty()) {
+        return 0;
+    }
+    std::size_t index = std::min(latencies.size() - 1, static_cast<std::size_t>(fraction * latencies.size()));
+    std::nth_element(latencies.begin(), latencies.begin() + index, latencies.end());
+    return latencies[index];
+}
+
+static long peakRssKilobytes() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static void report(const std::string& container, const std::string& keys, std::size_t size,
+                   const std::string& workload, Measurement measurement) {
+    double throughput = measurement.seconds > 0 ? measurement.operations / measurement.seconds : 0;
+    std::uint64_t p50 = percentile(measurement.latencies, 0.5);
+    std::uint64_t p99 = percentile(measurement.latencies, 0.99);
+    std::uint64_t p999 = percentile(measurement.latencies, 0.999);
+    std::cout << "{\"container\":\"" << container << "\",\"keys\":\"" << keys << "\",\"size\":" << size
+              << ",\"workload\":\"" << workload << "\",\"operations\":" << measurement.operations
+              << ",\"ops_per_sec\":" << static_cast<std::uint64_t>(throughput)
+              << ",\"p50_ns\":" << p50 << ",\"p99_ns\":" << p99 << ",\"p999_ns\":" << p999
+              << ",\"peak_rss_kb\":" << peakRssKilobytes() << "}" << std::endl;
+}
+
+// insert, find (half hits), mixed read/write at 90/10 and 50/50, iterate,
+// copy and erase, in that order on one container.
+template<typename Container>
+static void runWorkloads(const std::string& name, const std::string& kind, std::size_t size) {
+    std::vector<Key> keys = makeKeys(kind, size, 1);
+    std::vector<Key> misses = makeKeys(kind == "sorted" ? "random" : kind, size, 2);
+    if (kind == "sorted") {
+        for (Key& key : misses) {
+            key = size + key % size;
+        }
+    }
+    Container container;
+    report(name, kind, size, "insert", measure(size, [&](std::size_t i) {
+        insertKey(container, keys[i]);
+    }));
+
+    std::size_t hits = 0;
+    report(name, kind, size, "find", measure(size, [&](std::size_t i) {
+        hits += findKey(container, i % 2 == 0 ? keys[i] : misses[i]);
+    }));
+
+    for (unsigned readPercent : {90u, 50u}) {
+        std::mt19937_64 generator(readPercent);
+        report(name, kind, size, "mixed_" + std::to_string(readPercent) + "_" + std::to_string(100 - readPercent),
+               measure(size, [&](std::size_t i) {
+            unsigned roll = generator() % 100;
+            if (roll < readPercent) {
+                hits += findKey(container, keys[generator() % size]);
+            }
+            else if (roll % 2 == 0) {
+                insertKey(container, misses[i]);
+            }
+            else {
+                container.erase(misses[generator() % size]);
+            }
+        }));
+    }
+
+    Key sum = 0;
+    Measurement iteration = measure(1, [&](std::size_t) {
+        sum += sumKeys(container);
+    });
+    iteration.operations = container.size();
+    iteration.latencies.clear();
+    report(name, kind, size, "iterate", iteration);
+
+    {
+        Container copy;
+        Measurement copying = measure(1, [&](std::size_t) {
+            copy = container;
+        });
+        copying.operations = copy.size();
+        copying.latencies.clear();
+        report(name, kind, size, "copy", copying);
+    }
+
+    report(name, kind, size, "erase", measure(size, [&](std::size_t i) {
+        container.erase(keys[i]);
+    }));
+    sink = hits + sum;
+}
+
+static const char* const defaultSizes = "1000,100000,1000000";
+static const char* const allContainers = "BinarySearchTree,std::multimap,Map,std::map,Set,CompactSet,std::set";
+static const char* const allKinds = "random,sorted,zipf,duplicates";
+
+static std::vector<std::string> splitList(const std::string& list) {
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        items.push_back(item);
+    }
+    return items;
+}
+
+// Positive decimal number that fits a size_t.
+static bool parseSize(const std::string& text, std::size_t& size) {
+    if (text.empty() || !std::all_of(text.begin(), text.end(), [](unsigned char c) { return std::isdigit(c); })) {
+        return false;
+    }
+    try {
+        unsigned long long value = std::stoull(text);
+        if (value == 0 || value > std::numeric_limits<std::size_t>::max()) {
+            return false;
+        }
+        size = static_cast<std::size_t>(value);
+    }
+    catch (const std::out_of_range&) {
+        return false;
+    }
+    return true;
+}
+
+static void printUsage(std::ostream& out, const char* program) {
+    out << "Usage: " << program << " [sizes] [containers] [key kinds]\n"
+        << "Each argument is a comma separated list.\n"
+        << "  sizes       positive element counts (default " << defaultSizes << ")\n"
+        << "  containers  any of " << allContainers << "\n"
+        << "  key kinds   any of " << allKinds << "\n";
+}
+
+template<typename Container>
+static void runIsolated(const std::string& name, const std::string& kind, std::size_t size) {
+    std::cout.flush();
+    pid_t child = fork();
+    if (child == 0) {
+        runWorkloads<Container>(name, kind, size);
+        std::cout.flush();
+        _exit(0);
+    }
+    if (child > 0) {
+        int status = 0;
+        waitpid(child, &status, 0);
+    }
+    else {
+        runWorkloads<Container>(name, kind, size);
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc > 4 || (argc > 1 && (std::string(argv[1]) == "-h" || std::string(argv[1]) == "--help"))) {
+        bool help = argc <= 4;
+        printUsage(help ? std::cout : std::cerr, argv[0]);
+        return help ? 0 : 1;
+    }
+    std::vector<std::string> sizeTexts = splitList(argc > 1 ? argv[1] : defaultSizes);
+    std::vector<std::string> containers = splitList(argc > 2 ? argv[2] : allContainers);
+    std::vector<std::string> kinds = splitList(argc > 3 ? argv[3] : allKinds);
+    std::vector<std::size_t> sizes;
+    for (const std::string& sizeText : sizeTexts) {
+        std::size_t size = 0;
+        if (!parseSize(sizeText, size)) {
+            std::cerr << "Invalid size '" << sizeText << "'" << std::endl;
+            printUsage(std::cerr, argv[0]);
+            return 1;
+        }
+        sizes.push_back(size);
+    }
+    std::vector<std::string> knownContainers = splitList(allContainers);
+    for (const std::string& container : containers) {
+        if (std::find(knownContainers.begin(), knownContainers.end(), container) == knownContainers.end()) {
+            std::cerr << "Unknown container '" << container << "'" << std::endl;
+            printUsage(std::cerr, argv[0]);
+            return 1;
+        }
+    }
+    std::vector<std::string> knownKinds = splitList(allKinds);
+    for (const std::string& kind : kinds) {
+        if (std::find(knownKinds.begin(), knownKinds.end(), kind) == knownKinds.end()) {
+            std::cerr << "Unknown key kind '" << kind << "'" << std::endl;
+            printUsage(std::cerr, argv[0]);
+            return 1;
+        }
+    }
+    if (sizes.empty() || containers.empty() || kinds.empty()) {
+        printUsage(std::cerr, argv[0]);
+        return 1;
+    }
+    for (std::size_t size : sizes) {
+        for (const std::string& kind : kinds) {
+            for (const std::string& container : containers) {
+                if (container == "BinarySearchTree") {
+                    runIsolated<BinarySearchTree<Key, Key>>(container, kind, size);
+                }
+                else if (container == "std::multimap") {
+                    runIsolated<std::multimap<Key, Key>>(container, kind, size);
+                }
+                else if (container == "Map") {
+                    runIsolated<Map<Key, Key>>(container, kind, size);
+                }
+                else if (container == "std::map") {
+                    runIsolated<std::map<Key, Key>>(container, kind, size);
+                }
+                else if (container == "Set") {
+                    runIsolated<Set<Key>>(container, kind, size);
+                }
+                else if (container == "CompactSet") {
+                    runIsolated<Set<Key, CompactSetTree<Key>>>(container, kind, size);
+                }
+                else {
+                    runIsolated<std::set<Key>>(container, kind, size);
+                }
+            }
+        }
+    }
+    return 0;
+}
@@ -28,6 +28,45 @@ int main() {
     std::cout << it->second << std::endl;
     std::cout << mit->second << std:: endl;
 
+    // A cursor keeps its place when the element it just returned is erased.
+    BinarySearchTree<int, int> duplicates;
+    duplicates.insert(5, 1);
+    duplicates.insert(5, 2);
+    duplicates.insert(5, 3);
+    duplicates.insert(9, 9);
+    BinarySearchTree<int, int>::Cursor cursor(duplicates);
+    for (auto iter = cursor.next(); iter != duplicates.end(); iter = cursor.next()) {
+        std::cout << iter->first << ":" << iter->second << ", ";
+        if (iter->first == 5) {
+            duplicates.erase(iter);
+        }
+    }
+    std::cout << duplicates.size() << std::endl;
+
+    // It also keeps its place across a bulk operation followed by an erase
+    // or an insert: both loops print 5:2, 5:3.
+    for (bool eraseAfter : {true, false}) {
+        BinarySearchTree<int, int> fives;
+        fives.insert(5, 3);
+        fives.insert(5, 2);
+        fives.insert(5, 1);
+        BinarySearchTree<int, int> onlyFive;
+        onlyFive.insert(5, 0);
+        BinarySearchTree<int, int>::Cursor fiveCursor(fives);
+        fiveCursor.next();
+        fives.intersect(onlyFive);
+        if (eraseAfter) {
+            fives.erase(fives.begin());
+        }
+        else {
+            fives.insert(5, 9);
+        }
+        for (auto iter = fiveCursor.next(); iter != fives.end(); iter = fiveCursor.next()) {
+            std::cout << iter->first << ":" << iter->second << ", ";
+        }
+        std::cout << std::endl;
+    }
+
     Map<int, std::string> map;
     map.insert(15, "hello");
     map.insert(16, "world");
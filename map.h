@@ -1,23 +1,79 @@
 #ifndef BST_MAP_H
 #define BST_MAP_H
+#include <algorithm>
+#include <istream>
+#include <iterator>
+#include <ostream>
+#include <stdexcept>
+#include <vector>
 #include "BinarySearchTree.h"
+#include "FrozenTree.h"
 
-template <typename Key, typename Value>
+template <typename Key, typename Value, typename Tree = BinarySearchTree<Key, Value>>
 class Map
 {
-    BinarySearchTree<Key, Value> _tree;
+    Tree _tree;
+
+    void sortUnique(std::vector<std::pair<Key, Value>>& entries) const;
 public:
-    using MapIterator = typename BinarySearchTree<Key, Value>::Iterator;
-    using ConstMapIterator = typename BinarySearchTree<Key, Value>::ConstIterator;
+    using MapIterator = typename Tree::Iterator;
+    using ConstMapIterator = typename Tree::ConstIterator;
 
     Map() = default;
     ~Map() = default;
 
+    template<typename InputIterator>
+    Map(InputIterator first, InputIterator last);
+
+    // Bulk-loads [first, last); for repeated keys the last value wins.
+    template<typename InputIterator>
+    void assign(InputIterator first, InputIterator last);
+
     void insert(const Key& key, const Value& value);
-    void erase(const Key& key);
+    void insert(Key&& key, Value&& value);
+
+    template<typename... Args>
+    std::pair<MapIterator, bool> tryEmplace(const Key& key, Args&&... args);
+
+    // O(1) amortized when key belongs right before hint, as when appending
+    // sorted keys with hint cend(); see Tree::tryEmplace.
+    void insert(ConstMapIterator hint, const Key& key, const Value& value);
+    template<typename... Args>
+    std::pair<MapIterator, bool> tryEmplace(ConstMapIterator hint, const Key& key, Args&&... args);
+
+    std::size_t erase(const Key& key);
 
     ConstMapIterator find(const Key& key) const;
     MapIterator find(const Key& key);
+    bool contains(const Key& key) const;
+
+    void findBatch(const std::vector<Key>& keys, std::vector<ConstMapIterator>& out) const;
+    void insertBatch(std::vector<std::pair<Key, Value>> keyValuePairs);
+
+    ConstMapIterator lowerBound(const Key& key) const;
+    MapIterator lowerBound(const Key& key);
+
+    ConstMapIterator upperBound(const Key& key) const;
+    MapIterator upperBound(const Key& key);
+
+    // Lookups by any key type the tree's comparator accepts, available when
+    // it declares is_transparent (such as std::less<>).
+    template<typename K, typename C = typename Tree::KeyCompare, typename = typename C::is_transparent>
+    std::size_t erase(const K& key);
+    template<typename K, typename C = typename Tree::KeyCompare, typename = typename C::is_transparent>
+    ConstMapIterator find(const K& key) const;
+    template<typename K, typename C = typename Tree::KeyCompare, typename = typename C::is_transparent>
+    MapIterator find(const K& key);
+    template<typename K, typename C = typename Tree::KeyCompare, typename = typename C::is_transparent>
+    bool contains(const K& key) const;
+    template<typename K, typename C = typename Tree::KeyCompare, typename = typename C::is_transparent>
+    ConstMapIterator lowerBound(const K& key) const;
+    template<typename K, typename C = typename Tree::KeyCompare, typename = typename C::is_transparent>
+    MapIterator lowerBound(const K& key);
+    template<typename K, typename C = typename Tree::KeyCompare, typename = typename C::is_transparent>
+    ConstMapIterator upperBound(const K& key) const;
+    template<typename K, typename C = typename Tree::KeyCompare, typename = typename C::is_transparent>
+    MapIterator upperBound(const K& key);
 
     const Value& operator[](const Key& key) const;
     Value& operator[](const Key& key);
@@ -28,73 +84,367 @@ public:
     ConstMapIterator cbegin() const;
     ConstMapIterator cend() const;
 
+    // Reverse iteration, see Tree::ReverseIteratorAdaptor.
+    auto rbegin();
+    auto rend();
+
+    auto crbegin() const;
+    auto crend() const;
+
+    // Resumable scan that survives inserts and erases, see Tree::Cursor.
+    auto cursor();
+
     std::size_t size() const;
+    // The tree's Stats policy object, see BinarySearchTree::stats.
+    const auto& stats() const;
+
+    // Set algebra by key; values come from this map whenever both have a key.
+    void unionWith(const Map& other);
+    void intersect(const Map& other);
+    void difference(const Map& other);
+    // Moves the elements whose keys are missing here out of other.
+    void merge(Map& other);
+
+    // Moves the keys not less than key into right; join appends right, whose
+    // keys must all be greater than the keys here.
+    void split(const Key& key, Map& right);
+    void join(Map& right);
+
+    // See BinarySearchTree::save; MappedMap serves the saved file in place.
+    // load accepts files saved from a BinarySearchTree with repeated keys
+    // and keeps one element per key, the last one in the file, as assign does.
+    void save(std::ostream& out) const;
+    void load(std::istream& in);
+
+    // Read-only copy for lookup-heavy use, see BinarySearchTree::freeze.
+    FrozenTree<Key, Value, typename Tree::KeyCompare> freeze() const;
+    const typename Tree::KeyCompare& keyCompare() const;
 };
 
-template<typename Key, typename Value>
-void Map<Key, Value>::insert(const Key &key, const Value &value) {
-    if (find(key) != end()) {
-        erase(key);
+// Sorts entries by key and keeps only the last value for each key.
+template<typename Key, typename Value, typename Tree>
+void Map<Key, Value, Tree>::sortUnique(std::vector<std::pair<Key, Value>>& entries) const {
+    auto compare = _tree.keyCompare();
+    auto keyLess = [&compare](const std::pair<Key, Value>& left, const std::pair<Key, Value>& right) {
+        return compare(left.first, right.first);
+    };
+    if (!std::is_sorted(entries.begin(), entries.end(), keyLess)) {
+        parallelStableSort(entries.begin(), entries.end(), keyLess);
     }
-    else
-        _tree.insert(key, value);
+    std::size_t unique = 0;
+    for (auto& entry : entries) {
+        if (unique > 0 && !compare(entries[unique - 1].first, entry.first)) {
+            entries[unique - 1].second = std::move(entry.second);
+        }
+        else {
+            entries[unique++] = std::move(entry);
+        }
+    }
+    entries.resize(unique);
+}
+
+template<typename Key, typename Value, typename Tree>
+template<typename InputIterator>
+Map<Key, Value, Tree>::Map(InputIterator first, InputIterator last) {
+    assign(first, last);
 }
 
-template<typename Key, typename Value>
-void Map<Key, Value>::erase(const Key &key) {
-    _tree.erase(key);
+template<typename Key, typename Value, typename Tree>
+template<typename InputIterator>
+void Map<Key, Value, Tree>::assign(InputIterator first, InputIterator last) {
+    std::vector<std::pair<Key, Value>> entries(first, last);
+    sortUnique(entries);
+    _tree.assign(std::make_move_iterator(entries.begin()), std::make_move_iterator(entries.end()));
+}
+
+template<typename Key, typename Value, typename Tree>
+void Map<Key, Value, Tree>::insert(const Key &key, const Value &value) {
+    auto [iterator, inserted] = _tree.tryEmplace(key, value);
+    if (!inserted) {
+        iterator->second = value;
+    }
+}
+
+template<typename Key, typename Value, typename Tree>
+void Map<Key, Value, Tree>::insert(ConstMapIterator hint, const Key &key, const Value &value) {
+    auto [iterator, inserted] = _tree.tryEmplace(hint, key, value);
+    if (!inserted) {
+        iterator->second = value;
+    }
 }
 
-template<typename Key, typename Value>
-typename Map<Key, Value>::ConstMapIterator Map<Key, Value>::find(const Key &key) const {
+template<typename Key, typename Value, typename Tree>
+template<typename... Args>
+std::pair<typename Map<Key, Value, Tree>::MapIterator, bool> Map<Key, Value, Tree>::tryEmplace(ConstMapIterator hint, const Key& key, Args&&... args) {
+    return _tree.tryEmplace(hint, key, std::forward<Args>(args)...);
+}
+
+template<typename Key, typename Value, typename Tree>
+void Map<Key, Value, Tree>::insert(Key &&key, Value &&value) {
+    auto [iterator, inserted] = _tree.tryEmplace(std::move(key), std::move(value));
+    if (!inserted) {
+        iterator->second = std::move(value);
+    }
+}
+
+template<typename Key, typename Value, typename Tree>
+template<typename... Args>
+std::pair<typename Map<Key, Value, Tree>::MapIterator, bool> Map<Key, Value, Tree>::tryEmplace(const Key &key, Args&&... args) {
+    return _tree.tryEmplace(key, std::forward<Args>(args)...);
+}
+
+template<typename Key, typename Value, typename Tree>
+std::size_t Map<Key, Value, Tree>::erase(const Key &key) {
+    return _tree.erase(key);
+}
+
+template<typename Key, typename Value, typename Tree>
+typename Map<Key, Value, Tree>::ConstMapIterator Map<Key, Value, Tree>::find(const Key &key) const {
     return ConstMapIterator(_tree.find(key));
 }
 
-template<typename Key, typename Value>
-typename Map<Key, Value>::MapIterator Map<Key, Value>::find(const Key &key) {
+template<typename Key, typename Value, typename Tree>
+typename Map<Key, Value, Tree>::MapIterator Map<Key, Value, Tree>::find(const Key &key) {
     return MapIterator (_tree.find(key));
 }
 
-template<typename Key, typename Value>
-const Value &Map<Key, Value>::operator[](const Key &key) const {
-    if (find(key) == end()) {
-        throw std::invalid_argument("Key not found!");
+template<typename Key, typename Value, typename Tree>
+typename Map<Key, Value, Tree>::ConstMapIterator Map<Key, Value, Tree>::lowerBound(const Key &key) const {
+    return _tree.lowerBound(key);
+}
+
+template<typename Key, typename Value, typename Tree>
+typename Map<Key, Value, Tree>::MapIterator Map<Key, Value, Tree>::lowerBound(const Key &key) {
+    return _tree.lowerBound(key);
+}
+
+template<typename Key, typename Value, typename Tree>
+typename Map<Key, Value, Tree>::ConstMapIterator Map<Key, Value, Tree>::upperBound(const Key &key) const {
+    return _tree.upperBound(key);
+}
+
+template<typename Key, typename Value, typename Tree>
+typename Map<Key, Value, Tree>::MapIterator Map<Key, Value, Tree>::upperBound(const Key &key) {
+    return _tree.upperBound(key);
+}
+
+template<typename Key, typename Value, typename Tree>
+bool Map<Key, Value, Tree>::contains(const Key &key) const {
+    return _tree.find(key) != _tree.cend();
+}
+
+template<typename Key, typename Value, typename Tree>
+template<typename K, typename C, typename>
+std::size_t Map<Key, Value, Tree>::erase(const K &key) {
+    return _tree.erase(key);
+}
+
+template<typename Key, typename Value, typename Tree>
+template<typename K, typename C, typename>
+typename Map<Key, Value, Tree>::ConstMapIterator Map<Key, Value, Tree>::find(const K &key) const {
+    return _tree.find(key);
+}
+
+template<typename Key, typename Value, typename Tree>
+template<typename K, typename C, typename>
+typename Map<Key, Value, Tree>::MapIterator Map<Key, Value, Tree>::find(const K &key) {
+    return _tree.find(key);
+}
+
+template<typename Key, typename Value, typename Tree>
+template<typename K, typename C, typename>
+bool Map<Key, Value, Tree>::contains(const K &key) const {
+    return _tree.find(key) != _tree.cend();
+}
+
+template<typename Key, typename Value, typename Tree>
+template<typename K, typename C, typename>
+typename Map<Key, Value, Tree>::ConstMapIterator Map<Key, Value, Tree>::lowerBound(const K &key) const {
+    return _tree.lowerBound(key);
+}
+
+template<typename Key, typename Value, typename Tree>
+template<typename K, typename C, typename>
+typename Map<Key, Value, Tree>::MapIterator Map<Key, Value, Tree>::lowerBound(const K &key) {
+    return _tree.lowerBound(key);
+}
+
+template<typename Key, typename Value, typename Tree>
+template<typename K, typename C, typename>
+typename Map<Key, Value, Tree>::ConstMapIterator Map<Key, Value, Tree>::upperBound(const K &key) const {
+    return _tree.upperBound(key);
+}
+
+template<typename Key, typename Value, typename Tree>
+template<typename K, typename C, typename>
+typename Map<Key, Value, Tree>::MapIterator Map<Key, Value, Tree>::upperBound(const K &key) {
+    return _tree.upperBound(key);
+}
+
+template<typename Key, typename Value, typename Tree>
+void Map<Key, Value, Tree>::findBatch(const std::vector<Key> &keys, std::vector<ConstMapIterator> &out) const {
+    _tree.findBatch(keys, out);
+}
+
+// Existing keys are found in one batched lookup and assigned; the rest go to
+// the tree in one batched insert.
+template<typename Key, typename Value, typename Tree>
+void Map<Key, Value, Tree>::insertBatch(std::vector<std::pair<Key, Value>> keyValuePairs) {
+    sortUnique(keyValuePairs);
+    std::vector<Key> keys;
+    keys.reserve(keyValuePairs.size());
+    for (const auto& keyValuePair : keyValuePairs) {
+        keys.push_back(keyValuePair.first);
     }
-    return _tree.find(key)->second;
+    std::vector<MapIterator> found;
+    _tree.findBatch(keys, found);
+    std::vector<std::pair<Key, Value>> missing;
+    for (std::size_t i = 0; i < keyValuePairs.size(); i++) {
+        if (found[i] != end()) {
+            found[i]->second = std::move(keyValuePairs[i].second);
+        }
+        else {
+            missing.push_back(std::move(keyValuePairs[i]));
+        }
+    }
+    _tree.insertBatch(std::move(missing));
 }
 
-template<typename Key, typename Value>
-Value &Map<Key, Value>::operator[](const Key &key) {
-    if (find(key) == end()) {
-        _tree.insert(key, Value());
+template<typename Key, typename Value, typename Tree>
+const Value &Map<Key, Value, Tree>::operator[](const Key &key) const {
+    ConstMapIterator iterator = find(key);
+    if (iterator == cend()) {
+        throw std::invalid_argument("Key not found!");
     }
-    return _tree.find(key)->second;
+    return iterator->second;
+}
+
+template<typename Key, typename Value, typename Tree>
+Value &Map<Key, Value, Tree>::operator[](const Key &key) {
+    return _tree.tryEmplace(key).first->second;
 }
 
-template<typename Key, typename Value>
-typename Map<Key, Value>::MapIterator Map<Key, Value>::begin() {
+template<typename Key, typename Value, typename Tree>
+typename Map<Key, Value, Tree>::MapIterator Map<Key, Value, Tree>::begin() {
     return MapIterator(_tree.begin());
 }
 
-template<typename Key, typename Value>
-typename Map<Key, Value>::MapIterator Map<Key, Value>::end() {
+template<typename Key, typename Value, typename Tree>
+typename Map<Key, Value, Tree>::MapIterator Map<Key, Value, Tree>::end() {
     return MapIterator(_tree.end());
 }
 
-template<typename Key, typename Value>
-typename Map<Key, Value>::ConstMapIterator Map<Key, Value>::cbegin() const {
+template<typename Key, typename Value, typename Tree>
+typename Map<Key, Value, Tree>::ConstMapIterator Map<Key, Value, Tree>::cbegin() const {
     return ConstMapIterator(_tree.cbegin());
 }
 
-template<typename Key, typename Value>
-typename Map<Key, Value>::ConstMapIterator Map<Key, Value>::cend() const {
+template<typename Key, typename Value, typename Tree>
+typename Map<Key, Value, Tree>::ConstMapIterator Map<Key, Value, Tree>::cend() const {
     return ConstMapIterator(_tree.cend());
 }
 
-template<typename Key, typename Value>
-std::size_t Map<Key, Value>::size() const {
+template<typename Key, typename Value, typename Tree>
+auto Map<Key, Value, Tree>::rbegin() {
+    return _tree.rbegin();
+}
+
+template<typename Key, typename Value, typename Tree>
+auto Map<Key, Value, Tree>::rend() {
+    return _tree.rend();
+}
+
+template<typename Key, typename Value, typename Tree>
+auto Map<Key, Value, Tree>::crbegin() const {
+    return _tree.crbegin();
+}
+
+template<typename Key, typename Value, typename Tree>
+auto Map<Key, Value, Tree>::crend() const {
+    return _tree.crend();
+}
+
+template<typename Key, typename Value, typename Tree>
+const auto& Map<Key, Value, Tree>::stats() const {
+    return _tree.stats();
+}
+
+template<typename Key, typename Value, typename Tree>
+auto Map<Key, Value, Tree>::cursor() {
+    return typename Tree::Cursor(_tree);
+}
+
+template<typename Key, typename Value, typename Tree>
+std::size_t Map<Key, Value, Tree>::size() const {
     return _tree.size();
 }
 
+template<typename Key, typename Value, typename Tree>
+void Map<Key, Value, Tree>::unionWith(const Map &other) {
+    _tree.unionWith(other._tree);
+}
+
+template<typename Key, typename Value, typename Tree>
+void Map<Key, Value, Tree>::intersect(const Map &other) {
+    _tree.intersect(other._tree);
+}
+
+template<typename Key, typename Value, typename Tree>
+void Map<Key, Value, Tree>::difference(const Map &other) {
+    _tree.difference(other._tree);
+}
+
+template<typename Key, typename Value, typename Tree>
+void Map<Key, Value, Tree>::merge(Map &other) {
+    _tree.merge(other._tree);
+}
+
+template<typename Key, typename Value, typename Tree>
+void Map<Key, Value, Tree>::split(const Key &key, Map &right) {
+    _tree.split(key, right._tree);
+}
+
+template<typename Key, typename Value, typename Tree>
+void Map<Key, Value, Tree>::join(Map &right) {
+    if (right.size() > 0 && lowerBound(right.cbegin()->first) != end()) {
+        throw std::invalid_argument("Maps overlap!");
+    }
+    _tree.join(right._tree);
+}
+
+template<typename Key, typename Value, typename Tree>
+void Map<Key, Value, Tree>::save(std::ostream &out) const {
+    _tree.save(out);
+}
+
+template<typename Key, typename Value, typename Tree>
+void Map<Key, Value, Tree>::load(std::istream &in) {
+    _tree.load(in);
+    const auto& compare = _tree.keyCompare();
+    auto previous = _tree.cbegin();
+    for (auto iter = previous; iter != _tree.cend(); previous = iter) {
+        ++iter;
+        if (iter != _tree.cend() && !compare(previous->first, iter->first)) {
+            std::vector<std::pair<Key, Value>> entries;
+            entries.reserve(_tree.size());
+            for (auto entry = _tree.cbegin(); entry != _tree.cend(); ++entry) {
+                entries.push_back(*entry);
+            }
+            sortUnique(entries);
+            _tree.assign(std::make_move_iterator(entries.begin()), std::make_move_iterator(entries.end()));
+            return;
+        }
+    }
+}
+
+template<typename Key, typename Value, typename Tree>
+FrozenTree<Key, Value, typename Tree::KeyCompare> Map<Key, Value, Tree>::freeze() const {
+    return FrozenTree<Key, Value, typename Tree::KeyCompare>(_tree.cbegin(), _tree.cend(), _tree.keyCompare());
+}
+
+template<typename Key, typename Value, typename Tree>
+const typename Tree::KeyCompare& Map<Key, Value, Tree>::keyCompare() const {
+    return _tree.keyCompare();
+}
 
 #endif //BST_MAP_H
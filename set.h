@@ -1,52 +1,240 @@
 #ifndef BST_SET_H
 #define BST_SET_H
 
+#include <iterator>
+#include <vector>
 #include "map.h"
 
-template <typename Value>
+template <typename Value, typename Tree = BinarySearchTree<Value, Value>>
 class Set
 {
-    Map<Value, Value> _map;
+    Map<Value, Value, Tree> _map;
 
 public:
-    using SetIterator = typename Map<Value, Value>::MapIterator;
-    using ConstSetIterator = typename Map<Value, Value>::ConstMapIterator;
+    using SetIterator = typename Map<Value, Value, Tree>::MapIterator;
+    using ConstSetIterator = typename Map<Value, Value, Tree>::ConstMapIterator;
 
     Set() = default;
     ~Set() = default;
 
+    template<typename InputIterator>
+    Set(InputIterator first, InputIterator last);
+
+    template<typename InputIterator>
+    void assign(InputIterator first, InputIterator last);
+
     void insert(const Value& value);
-    void erase(const Value& value);
+    // See Map::insert with a hint.
+    void insert(ConstSetIterator hint, const Value& value);
+    std::size_t erase(const Value& value);
 
     ConstSetIterator find(const Value& value) const;
     SetIterator find(const Value& key);
 
     bool contains(const Value& value) const;
+
+    // See Map: lookups by other key types when the comparator is transparent.
+    template<typename K, typename C = typename Tree::KeyCompare, typename = typename C::is_transparent>
+    std::size_t erase(const K& value);
+    template<typename K, typename C = typename Tree::KeyCompare, typename = typename C::is_transparent>
+    ConstSetIterator find(const K& value) const;
+    template<typename K, typename C = typename Tree::KeyCompare, typename = typename C::is_transparent>
+    SetIterator find(const K& value);
+    template<typename K, typename C = typename Tree::KeyCompare, typename = typename C::is_transparent>
+    bool contains(const K& value) const;
+
+    ConstSetIterator cbegin() const;
+    ConstSetIterator cend() const;
+
+    auto crbegin() const;
+    auto crend() const;
+
+    std::size_t size() const;
+
+    auto cursor();
+    const auto& stats() const;
+
+    void findBatch(const std::vector<Value>& values, std::vector<ConstSetIterator>& out) const;
+    void insertBatch(const std::vector<Value>& values);
+
+    void unionWith(const Set& other);
+    void intersect(const Set& other);
+    void difference(const Set& other);
+    void merge(Set& other);
+
+    void split(const Value& value, Set& right);
+    void join(Set& right);
+
+    void save(std::ostream& out) const;
+    void load(std::istream& in);
+
+    // Read-only copy that stores each value once, see Map::freeze.
+    FrozenTree<Value, Value, typename Tree::KeyCompare, true> freeze() const;
 };
 
-template<typename Value>
-void Set<Value>::insert(const Value &value) {
-    _map.insert(value, value);
+template<typename Value, typename Tree>
+template<typename InputIterator>
+Set<Value, Tree>::Set(InputIterator first, InputIterator last) {
+    assign(first, last);
+}
+
+template<typename Value, typename Tree>
+template<typename InputIterator>
+void Set<Value, Tree>::assign(InputIterator first, InputIterator last) {
+    std::vector<std::pair<Value, Value>> entries;
+    for (; first != last; ++first) {
+        entries.emplace_back(*first, *first);
+    }
+    _map.assign(std::make_move_iterator(entries.begin()), std::make_move_iterator(entries.end()));
+}
+
+template<typename Value, typename Tree>
+void Set<Value, Tree>::insert(const Value &value) {
+    _map.tryEmplace(value, value);
 }
 
-template<typename Value>
-void Set<Value>::erase(const Value &value) {
-    _map.erase(value);
+template<typename Value, typename Tree>
+void Set<Value, Tree>::insert(ConstSetIterator hint, const Value &value) {
+    _map.tryEmplace(hint, value, value);
 }
 
-template<typename Value>
-typename Set<Value>::ConstSetIterator Set<Value>::find(const Value &value) const {
+template<typename Value, typename Tree>
+std::size_t Set<Value, Tree>::erase(const Value &value) {
+    return _map.erase(value);
+}
+
+template<typename Value, typename Tree>
+typename Set<Value, Tree>::ConstSetIterator Set<Value, Tree>::find(const Value &value) const {
     return _map.find(value);
 }
 
-template<typename Value>
-typename Set<Value>::SetIterator Set<Value>::find(const Value &key) {
+template<typename Value, typename Tree>
+typename Set<Value, Tree>::SetIterator Set<Value, Tree>::find(const Value &key) {
     return _map.find(key);
 }
 
-template<typename Value>
-bool Set<Value>::contains(const Value &value) const {
-    return find(value) != ConstSetIterator(nullptr);
+template<typename Value, typename Tree>
+bool Set<Value, Tree>::contains(const Value &value) const {
+    return find(value) != _map.cend();
+}
+
+template<typename Value, typename Tree>
+template<typename K, typename C, typename>
+std::size_t Set<Value, Tree>::erase(const K &value) {
+    return _map.erase(value);
+}
+
+template<typename Value, typename Tree>
+template<typename K, typename C, typename>
+typename Set<Value, Tree>::ConstSetIterator Set<Value, Tree>::find(const K &value) const {
+    return _map.find(value);
+}
+
+template<typename Value, typename Tree>
+template<typename K, typename C, typename>
+typename Set<Value, Tree>::SetIterator Set<Value, Tree>::find(const K &value) {
+    return _map.find(value);
+}
+
+template<typename Value, typename Tree>
+template<typename K, typename C, typename>
+bool Set<Value, Tree>::contains(const K &value) const {
+    return _map.contains(value);
+}
+
+template<typename Value, typename Tree>
+typename Set<Value, Tree>::ConstSetIterator Set<Value, Tree>::cbegin() const {
+    return _map.cbegin();
+}
+
+template<typename Value, typename Tree>
+typename Set<Value, Tree>::ConstSetIterator Set<Value, Tree>::cend() const {
+    return _map.cend();
+}
+
+template<typename Value, typename Tree>
+auto Set<Value, Tree>::crbegin() const {
+    return _map.crbegin();
+}
+
+template<typename Value, typename Tree>
+auto Set<Value, Tree>::crend() const {
+    return _map.crend();
+}
+
+template<typename Value, typename Tree>
+std::size_t Set<Value, Tree>::size() const {
+    return _map.size();
+}
+
+template<typename Value, typename Tree>
+const auto& Set<Value, Tree>::stats() const {
+    return _map.stats();
+}
+
+template<typename Value, typename Tree>
+auto Set<Value, Tree>::cursor() {
+    return _map.cursor();
+}
+
+template<typename Value, typename Tree>
+void Set<Value, Tree>::findBatch(const std::vector<Value> &values, std::vector<ConstSetIterator> &out) const {
+    _map.findBatch(values, out);
+}
+
+template<typename Value, typename Tree>
+void Set<Value, Tree>::insertBatch(const std::vector<Value> &values) {
+    std::vector<std::pair<Value, Value>> entries;
+    entries.reserve(values.size());
+    for (const Value& value : values) {
+        entries.emplace_back(value, value);
+    }
+    _map.insertBatch(std::move(entries));
+}
+
+template<typename Value, typename Tree>
+void Set<Value, Tree>::unionWith(const Set &other) {
+    _map.unionWith(other._map);
+}
+
+template<typename Value, typename Tree>
+void Set<Value, Tree>::intersect(const Set &other) {
+    _map.intersect(other._map);
+}
+
+template<typename Value, typename Tree>
+void Set<Value, Tree>::difference(const Set &other) {
+    _map.difference(other._map);
+}
+
+template<typename Value, typename Tree>
+void Set<Value, Tree>::merge(Set &other) {
+    _map.merge(other._map);
+}
+
+template<typename Value, typename Tree>
+void Set<Value, Tree>::split(const Value &value, Set &right) {
+    _map.split(value, right._map);
+}
+
+template<typename Value, typename Tree>
+void Set<Value, Tree>::join(Set &right) {
+    _map.join(right._map);
+}
+
+template<typename Value, typename Tree>
+void Set<Value, Tree>::save(std::ostream &out) const {
+    _map.save(out);
+}
+
+template<typename Value, typename Tree>
+void Set<Value, Tree>::load(std::istream &in) {
+    _map.load(in);
+}
+
+template<typename Value, typename Tree>
+FrozenTree<Value, Value, typename Tree::KeyCompare, true> Set<Value, Tree>::freeze() const {
+    return FrozenTree<Value, Value, typename Tree::KeyCompare, true>(_map.cbegin(), _map.cend(), _map.keyCompare());
 }
 
 #endif //BST_SET_H